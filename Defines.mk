@@ -39,7 +39,7 @@ OS = -D_LINUX_
 DEBUG = -g
 #NUMA = -DNUMA_SUPPORT
 CFLAGS = $(DEBUG) -Wall -O3 $(OS) $(NUMA) -DMMAP_POPULATE -fstrict-aliasing -Wstrict-aliasing -fpermissive
-LIBS = -lpthread -lrt
+LIBS = -lpthread -lrt -lz $(if $(NUMA),-lnuma)
 endif
 
 ifeq ($(OSTYPE),SunOS)
@@ -47,14 +47,14 @@ OS =  -D_SOLARIS_
 DEBUG = -g
 #NUMA = -DNUMA_SUPPORT
 CFLAGS = $(DEBUG) -Wall -O3 $(OS) $(NUMA) -D_FILE_OFFSET_BITS=64 
-LIBS = -lm -lrt -lthread -lmtmalloc -llgrp
+LIBS = -lm -lrt -lthread -lmtmalloc -llgrp -lz
 endif
 
 ifeq ($(OSTYPE),Darwin)
 OS = -D_DARWIN_
 DEBUG = -g
 CFLAGS = $(DEBUG) -Wall -O3 $(OS)
-LIBS = -lpthread
+LIBS = -lpthread -lz
 endif
 
 ARCHTYPE = $(shell uname -p)
@@ -95,3 +95,6 @@ LIB_DIR = lib
 INC_DIR = include
 WC_DIR = word_count
 II_DIR = inverted_index
+BENCH_DIR = bench
+TOOLS_DIR = tools
+TESTS_DIR = tests
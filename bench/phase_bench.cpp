@@ -0,0 +1,88 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Phase transition latency microbenchmark.
+   Runs back-to-back thread_pool::begin/wait cycles with an empty worker 
+   function and reports the average round trip per phase for 1 to 
+   MAX_THREADS threads. */
+
+#include "stddefines.h"
+#include "thread_pool.h"
+#include "scheduler.h"
+
+#define NUM_PHASES      20000
+#define MAX_THREADS     128
+
+static void worker(void* arg, thread_loc const& loc)
+{
+}
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+    int phases = argc > 2 ? atoi(argv[2]) : NUM_PHASES;
+
+    printf("%8s %14s\n", "threads", "usec/phase");
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        sched_policy_strand_fill policy(0);
+        thread_pool pool(threads, &policy);
+
+        void** args = new void*[threads];
+        for (int i = 0; i < threads; i++)
+            args[i] = NULL;
+
+        // warm up, the threads are still starting.
+        CHECK_ERROR (pool.set(worker, args, threads));
+        CHECK_ERROR (pool.begin());
+        CHECK_ERROR (pool.wait());
+
+        double begin = now();
+        for (int i = 0; i < phases; i++) {
+            CHECK_ERROR (pool.set(worker, args, threads));
+            CHECK_ERROR (pool.begin());
+            CHECK_ERROR (pool.wait());
+        }
+        double elapsed = now() - begin;
+
+        printf("%8d %14.2f\n", threads, elapsed / phases * 1e6);
+        fflush(stdout);
+
+        delete [] args;
+    }
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
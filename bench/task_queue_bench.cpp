@@ -0,0 +1,165 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Task queue throughput microbenchmark.
+   Every worker drains the queues and each task spawns a child task on the
+   worker's own queue until its depth runs out, so both the owner path and
+   stealing are exercised. Reports dequeued tasks per second for 1 to 
+   as many threads as there are CPUs to run them, see proc_get_num_cpus,
+   by default. The spin locks do not yield, so more threads than CPUs 
+   can take very long to finish. The lock-free queues are a separate build, see 
+   Makefile; the locked queues take the lock types to compare as 
+   arguments, all of them by default. With MR_LOCKSTATS=1 the share of 
+   contended lock acquisitions is reported as well, and how evenly the
+   acquisitions spread over the sub-queues: the most taken lock's count 
+   over the least taken one's, 1.00 when every thread works its own.
+
+   usage: task_queue_bench [max threads] [mutex|mcs|ticket|ttas ...] */
+
+#include <string.h>
+#include <algorithm>
+
+#include "stddefines.h"
+#include "task_queue.h"
+#include "thread_pool.h"
+#include "scheduler.h"
+
+#define NUM_ROOT_TASKS      (1 << 16)
+#define TASK_DEPTH          8
+
+
+static task_queue* queue;
+
+static void worker(void* arg, thread_loc const& loc)
+{
+    uint64_t* count = (uint64_t*)arg;
+    task_queue::task_t task;
+    while (queue->dequeue(task, loc)) {
+        (*count)++;
+        if (task.len > 0) {
+            task_queue::task_t child = { task.id, task.len - 1, 0, 0 };
+            queue->enqueue(child, loc);
+        }
+    }
+}
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(char const* variant, lock::lock_type type, bool profile,
+    int max_threads)
+{
+    // Powers of two, and MAX_THREADS itself.
+    for (int threads = 1; threads <= max_threads; 
+        threads = threads < max_threads ? std::min(threads * 2, max_threads) :
+            threads + 1)
+    {
+        sched_policy_strand_fill policy(0);
+        thread_pool pool(threads, &policy);
+        queue = new task_queue(threads, threads, type, profile);
+
+        for (uint64_t i = 0; i < NUM_ROOT_TASKS; i++) {
+            task_queue::task_t task = { i, TASK_DEPTH, 0, 0 };
+            queue->enqueue_seq(task, NUM_ROOT_TASKS);
+        }
+
+        uint64_t* counts = new uint64_t[threads * 8];
+        void** args = new void*[threads];
+        memset(counts, 0, sizeof(uint64_t) * threads * 8);
+        for (int i = 0; i < threads; i++)
+            args[i] = &counts[i * 8];   // one cache line each
+
+        double begin = now();
+        CHECK_ERROR (pool.set(worker, args, threads));
+        CHECK_ERROR (pool.begin());
+        CHECK_ERROR (pool.wait());
+        double elapsed = now() - begin;
+
+        uint64_t total = 0;
+        for (int i = 0; i < threads; i++)
+            total += counts[i * 8];
+        CHECK_ERROR (total != (uint64_t)NUM_ROOT_TASKS * (TASK_DEPTH + 1));
+
+        printf("%-10s %8d %14.0f", variant, threads, total / elapsed);
+
+        lock::stats ls;
+        uint64_t acquisitions = 0, contended = 0;
+        uint64_t most = 0, least = UINT64_MAX;
+        for (int q = 0; q < queue->num_sub_queues(); q++) {
+            if (queue->get_lock_stats(q, ls)) {
+                acquisitions += ls.acquisitions;
+                contended += ls.contended;
+                most = std::max(most, ls.acquisitions);
+                least = std::min(least, ls.acquisitions);
+            }
+        }
+        if (acquisitions > 0)
+            printf(" %11.2f%% %8.2f", 100.0 * contended / acquisitions,
+                (double)most / std::max(least, (uint64_t)1));
+        printf("\n");
+        fflush(stdout);
+
+        delete [] args;
+        delete [] counts;
+        delete queue;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = argc > 1 ? atoi(argv[1]) : proc_get_num_cpus();
+    bool profile = atoi(GETENV("MR_LOCKSTATS")) != 0;
+
+    printf("%-10s %8s %14s%s\n", "variant", "threads", "tasks/s",
+        profile ? "   contended  max/min" : "");
+
+#ifdef MR_QUEUE_CHASE_LEV
+    run("chase-lev", lock::default_type(), false, max_threads);
+#else
+    if (argc <= 2) {
+        for (int t = lock::MUTEX; t <= lock::TTAS; t++)
+            run(lock::type_name((lock::lock_type)t), (lock::lock_type)t, 
+                profile, max_threads);
+    }
+    for (int i = 2; i < argc; i++) {
+        lock::lock_type type;
+        if (!lock::parse_type(argv[i], type)) {
+            fprintf(stderr, "unknown lock type %s\n", argv[i]);
+            return 1;
+        }
+        run(argv[i], type, profile, max_threads);
+    }
+#endif
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
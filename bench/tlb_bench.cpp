@@ -0,0 +1,118 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Huge page microbenchmark.
+   Counts the words of a synthetic corpus of random word ids in a 
+   hash_table, as word_count's map tasks do, once with the table on 
+   regular pages and once with it on huge pages (huge_page_allocator with
+   MR_HUGEPAGES=1). The table grows to hundreds of MB with the default 
+   vocabulary, so most probes miss the TLB on regular pages. Reports the 
+   time and, where the hardware counters are available, the dTLB load 
+   misses of both runs.
+
+   usage: tlb_bench [words in millions] [distinct words in millions] */
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "stddefines.h"
+#include "container.h"
+#include "huge_pages.h"
+#include "perf_counter.h"
+
+#define NUM_WORDS       64      // millions
+#define NUM_DISTINCT    8       // millions
+
+struct count
+{
+    uint64_t n;
+    count() : n(0) {}
+    void merge(count const& other) { n += other.n; }
+    void clear() { n = 0; }
+};
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+template<template<class> class Allocator>
+static void run(char const* name, uint64_t const* words, uint64_t num_words)
+{
+    cache_counter tlb(cache_counter::DTLB);
+    double begin = now();
+
+    uint64_t distinct = 0;
+    {
+        hash_table<uint64_t, count, std::tr1::hash<uint64_t>, Allocator> t;
+        for (uint64_t i = 0; i < num_words; i++)
+            t[words[i]].n++;
+        for (typename hash_table<uint64_t, count, std::tr1::hash<uint64_t>, 
+            Allocator>::const_iterator i = t.begin(); i != t.end(); ++i)
+            distinct++;
+    }
+
+    double elapsed = now() - begin;
+    uint64_t loads, misses;
+    if (tlb.read(loads, misses))
+        printf("%-8s %10lu %10.3f %14lu %14lu %8.3f%%\n", name, distinct, 
+            elapsed, loads, misses, 100.0 * misses / std::max(loads, 1UL));
+    else
+        printf("%-8s %10lu %10.3f %14s %14s %9s\n", name, distinct, 
+            elapsed, "-", "-", "-");
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t num_words = (argc > 1 ? atof(argv[1]) : NUM_WORDS) * 1e6;
+    uint64_t num_distinct = (argc > 2 ? atof(argv[2]) : NUM_DISTINCT) * 1e6;
+    num_distinct = std::max(num_distinct, (uint64_t)1);
+
+    setenv("MR_HUGEPAGES", "1", 1);
+
+    // A uniform vocabulary, which is the worst case for the TLB.
+    uint64_t* words = new uint64_t[num_words];
+    uint64_t x = 88172645463325252ULL;
+    for (uint64_t i = 0; i < num_words; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        words[i] = (x % num_distinct) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    printf("%-8s %10s %10s %14s %14s %9s\n", "pages", "distinct", 
+        "seconds", "dTLB loads", "dTLB misses", "miss rate");
+    run<std::allocator>("regular", words, num_words);
+    run<huge_page_allocator>("huge", words, num_words);
+
+    delete [] words;
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
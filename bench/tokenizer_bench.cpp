@@ -0,0 +1,156 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Tokenizer microbenchmark.
+   Splits a file into words as the map tasks of word_count (words only) 
+   and inverted_index (words and lines) do, once with the byte-by-byte 
+   loop they used before tokenize, and once with tokenize on every 
+   classifier the processor has. Each run also hashes every word into a
+   str_key, as the map tasks do. Reports millions of words per second 
+   and the input bandwidth.
+
+   usage: tokenizer_bench [file] [passes] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <time.h>
+#include <string>
+
+#include "stddefines.h"
+#include "str_key.h"
+#include "tokenizer.h"
+
+#define DEFAULT_FILE    "../data/sherlock.txt"
+#define PASSES          20
+
+static double now()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// How the words were hashed before: toupper per byte.
+struct toupper_traits
+{
+    static char normalize(char c) { return toupper((unsigned char)c); }
+};
+
+static inline char upper(char c)
+{
+    return toupper((unsigned char)c);
+}
+
+struct sink
+{
+    uint64_t words, hashes;
+
+    template<class Traits>
+    void add(char const* data, uint64_t len, uint64_t line) {
+        words++;
+        hashes += str_key<Traits>(data, len).hash + line;
+    }
+    void operator()(char const* data, uint64_t len, uint64_t line) {
+        add<str_key_nocase_traits>(data, len, line);
+    }
+};
+
+// The map loop of both applications before tokenize.
+static uint64_t loop(char const* data, uint64_t len, bool lines, sink& out)
+{
+    uint64_t count_lines = 1;
+    uint64_t i = 0;
+    while(i < len)
+    {
+        while(i < len && (upper(data[i]) < 'A' || upper(data[i]) > 'Z')){
+            i++;
+            if(lines && i < len && data[i] == '\n')
+                count_lines++;
+        }
+        uint64_t start = i;
+        while(i < len && ((upper(data[i]) >= 'A' && upper(data[i]) <= 'Z') || data[i] == '\''))
+            i++;
+        if(i > start)
+            out.add<toupper_traits>(data + start, i - start, count_lines);
+    }
+    return count_lines;
+}
+
+static void report(char const* name, bool lines, double elapsed, 
+    uint64_t bytes, sink const& s)
+{
+    printf("%-8s %-6s %10.1f %10.1f %12lu\n", name, lines ? "lines" : 
+        "words", s.words / elapsed / 1e6, bytes / elapsed / 1e6, s.words);
+    fflush(stdout);
+}
+
+int main(int argc, char* argv[])
+{
+    char const* path = argc > 1 ? argv[1] : DEFAULT_FILE;
+    int passes = argc > 2 ? atoi(argv[2]) : PASSES;
+
+    FILE* f = fopen(path, "rb");
+    CHECK_ERROR(f == NULL);
+    std::string text;
+    char buf[1 << 16];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        text.append(buf, n);
+    fclose(f);
+    uint64_t bytes = text.size() * passes;
+
+    printf("%-8s %-6s %10s %10s %12s\n", "tokenize", "mode", "Mwords/s", 
+        "MB/s", "words");
+    for (int lines = 0; lines < 2; lines++) {
+        sink s = { 0, 0 };
+        double begin = now();
+        for (int p = 0; p < passes; p++)
+            loop(text.data(), text.size(), lines, s);
+        report("loop", lines, now() - begin, bytes, s);
+
+        for (int isa = TOKENIZER_SCALAR; isa <= TOKENIZER_AVX2; isa++) {
+            if (tokenizer_use((tokenizer_isa)isa) != isa)
+                continue;
+            sink t = { 0, 0 };
+            begin = now();
+            for (int p = 0; p < passes; p++) {
+                if (lines)
+                    tokenize<true>(text.data(), text.size(), text.size(), t);
+                else
+                    tokenize<false>(text.data(), text.size(), text.size(), t);
+            }
+            report(tokenizer_name((tokenizer_isa)isa), lines, now() - begin, 
+                bytes, t);
+            CHECK_ERROR(t.words != s.words || t.hashes != s.hashes);
+        }
+    }
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -53,6 +53,9 @@ static inline void spin_wait(int n)
 
 static inline void flush(void* addr) {asm("":::"memory");}
 
+/* full fence, orders earlier stores before later loads */
+static inline void memory_barrier(void) {asm volatile("mfence":::"memory");}
+
 static inline uintptr_t atomic_read(void* addr) { return *((uintptr_t*)addr); }
 
 /* returns zero if already set, returns nonzero if not set */
@@ -84,6 +87,22 @@ static inline unsigned int fetch_and_inc(unsigned int* n)
     return oldval;
 }
 
+/* subtracts 1 from value pointed to in 'n', returns old value */
+static inline unsigned int fetch_and_dec(unsigned int* n)
+{
+    unsigned int    oldval;
+
+    __asm__ __volatile__(
+        "movl        $-1, %0        \n"
+        "lock xaddl    %0, (%1)    \n"
+    : "=a" (oldval) : "b" (n) : "memory");
+
+    return oldval;
+}
+
+/* hint to the processor that we are in a spin loop */
+static inline void cpu_relax(void) {asm volatile("pause":::"memory");}
+
 /* returns true on swap */
 static inline int cmp_and_swp(uintptr_t v, uintptr_t* cmper, uintptr_t matcher)
 {
@@ -129,6 +148,30 @@ static inline unsigned int fetch_and_inc(unsigned int* n)
     return old_v;
 }
 
+static inline unsigned int fetch_and_dec(unsigned int* n)
+{
+    unsigned int    v, old_v;
+    __asm__ __volatile__(
+        "1:                    \n"
+        "membar    #StoreLoad | #LoadLoad        \n"
+        "lduw    [%2], %1            \n"
+        "sub    %1, 1, %0            \n"
+        "cas    [%2], %1, %0            \n"
+        "cmp    %1, %0                \n"
+        "bne,pn    %icc, 1b            \n"
+        " nop                    \n"
+        "membar #StoreLoad | #StoreStore    \n"
+    : "=r" (v), "=r" (old_v)
+    : "r" (n)
+    : "cc", "memory");
+    return old_v;
+}
+
+static inline void cpu_relax(void)
+{
+    __asm__ __volatile__("" ::: "memory");
+}
+
 static inline int cmp_and_swp(uintptr_t v, uintptr_t* cmper, uintptr_t matcher)
 {
     int    swapped;
@@ -180,6 +223,12 @@ static inline void flush(void* addr)
     __asm__ __volatile__("" ::: "memory");
 }
 
+static inline void memory_barrier(void)
+{
+    __asm__ __volatile__("membar #StoreLoad | #StoreStore | #LoadLoad\n" 
+        ::: "memory");
+}
+
 static inline uintptr_t atomic_read(void* addr)
 {
     uintptr_t    v;
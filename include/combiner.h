@@ -45,10 +45,25 @@ public:
         data->push_back(v);
     }
 
+    // fold the contents of another combiner into this one.
+    void merge(buffer_combiner const& other) {
+        data->insert(data->end(), other.data->begin(), other.data->end());
+    }
+
+    // drop the values but keep the storage, e.g. for a front cache slot.
+    void clear() {
+        data->clear();
+    }
+
     bool empty() const {
         return data->size() == 0;
     }
 
+    // number of values the reducer will see.
+    uint64_t weight() const {
+        return data->size();
+    }
+
     class combined
     {
         std::vector< std::vector<V, Allocator<V> >*, 
@@ -120,10 +135,26 @@ public:
         _empty = false;
     }
 
+    void merge(associative_combiner const& other) {
+        if(!other._empty) {
+            Impl::F(data, other.data);
+            _empty = false;
+        }
+    }
+
+    void clear() {
+        Impl::Init(data);
+        _empty = true;
+    }
+
     bool empty() const {
         return _empty;
     }
 
+    uint64_t weight() const {
+        return _empty ? 0 : 1;
+    }
+
     class combined
     {
         V m;
@@ -173,10 +204,23 @@ public:
         data->push_back(v);
     }
 
+    void merge(associative_combiner const& other) {
+        data->insert(data->end(), other.data->begin(), other.data->end());
+    }
+
+    void clear() {
+        data->clear();
+    }
+
     bool empty() const {
         return data->size() == 0;
     }
 
+    // number of values the reducer will see.
+    uint64_t weight() const {
+        return data->size();
+    }
+
     class combined
     {
         std::vector< std::vector<V, Allocator<V> >*, 
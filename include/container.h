@@ -38,17 +38,73 @@ class hash_table
 {
 private:
     typedef std::pair<K, V> entry;
+    
+    // Optional direct-mapped pre-aggregation cache in front of the table.
+    // It is kept small enough to stay L1 resident so that hot keys fold
+    // into the cached value without probing the (much larger) table. 
+    // Entries only reach the table when evicted or flushed.
+    struct cache_entry {
+        K key;
+        V val;
+        uint64_t hash;
+        bool valid;
+    };
+
     std::vector< entry, Allocator<entry> > table;
     std::vector< bool, Allocator<bool> > occupied;
+    std::vector< cache_entry, Allocator<cache_entry> > cache;
     Hash kh;
     uint64_t size;
     uint64_t load;
+    uint64_t cache_mask;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+
+    V& lookup(K const& key, uint64_t hash)
+    {
+        uint64_t index = hash & (size-1);
+        while(occupied[index] && !(table[index].first == key)) {
+            index = (index+1) & (size-1);
+        }
+
+        if(occupied[index])
+            return table[index].second;
+        else {
+            load++;
+            if(load >= size>>1) {
+                rehash(size<<1);
+                index = hash & (size-1);
+                while(occupied[index] && !(table[index].first == key)) {
+                    index = (index+1) & (size-1);
+                }
+            }
+            table[index].first = key;
+            table[index].second = V();
+            occupied[index] = true;
+            return table[index].second;
+        }
+    }
+
 public:
-    hash_table()
+    // cache_size is the number of front cache entries, rounded up to a 
+    // power of two. Zero disables the cache. V needs merge() and clear().
+    hash_table(uint64_t cache_size = 0)
     {
         size = 0;
         load = 0;
+        cache_mask = 0;
+        cache_hits = 0;
+        cache_misses = 0;
         rehash(256);
+
+        if(cache_size > 0) {
+            uint64_t n = 1;
+            while(n < cache_size) n <<= 1;
+            cache.resize(n);
+            for(uint64_t i = 0; i < n; i++)
+                cache[i].valid = false;
+            cache_mask = n-1;
+        }
     }
     
     ~hash_table()
@@ -74,29 +130,44 @@ public:
 
     V& operator[] (K const& key) 
     {
-        uint64_t index = kh(key) & (size-1);
-        while(occupied[index] && !(table[index].first == key)) {
-            index = (index+1) & (size-1);
+        uint64_t hash = kh(key);
+        if(cache_mask == 0)
+            return lookup(key, hash);
+
+        cache_entry& c = cache[hash & cache_mask];
+        if(c.valid && c.hash == hash && c.key == key) {
+            cache_hits++;
+            return c.val;
         }
 
-        if(occupied[index])
-            return table[index].second;
-        else {
-            load++;
-            if(load >= size>>1) {
-                rehash(size<<1);
-                index = kh(key) & (size-1);
-                while(occupied[index] && !(table[index].first == key)) {
-                    index = (index+1) & (size-1);
-                }
+        // Miss: write back the current occupant, then take over the slot.
+        // The slot's combiner is emptied and reused, which keeps e.g. a 
+        // buffer_combiner's storage instead of allocating a new one.
+        cache_misses++;
+        if(c.valid)
+            lookup(c.key, c.hash).merge(c.val);
+        c.val.clear();
+        c.key = key;
+        c.hash = hash;
+        c.valid = true;
+        return c.val;
+    }
+
+    // Write back all cached entries to the table. Must be called before 
+    // iterating over the table.
+    void flush()
+    {
+        for(uint64_t i = 0; i < cache.size(); i++) {
+            if(cache[i].valid) {
+                lookup(cache[i].key, cache[i].hash).merge(cache[i].val);
+                cache[i].valid = false;
             }
-            table[index].first = key;
-            table[index].second = V();
-            occupied[index] = true;
-            return table[index].second;
         }
     }
 
+    uint64_t hits() const { return cache_hits; }
+    uint64_t misses() const { return cache_misses; }
+
     class const_iterator {
         hash_table const* a;
         uint64_t index;
@@ -151,18 +222,55 @@ public:
 private:
     std::vector< KCV, Allocator<KCV> >* vals; 
     uint64_t in_size, out_size;
+    uint64_t cache_size;
+    std::vector<uint64_t> cache_hits, cache_misses;
+    double hot_fraction;
 public:
 
     typedef hash_table<K, Combiner<V, Allocator>, Hash, Allocator > input_type;
     typedef typename Combiner<V, Allocator>::combined output_type;
 
-    hash_container() : vals(NULL), in_size(0), out_size(0) {}
+    hash_container() : vals(NULL), in_size(0), out_size(0), cache_size(0),
+        hot_fraction(0) {}
 
     void init(uint64_t in_size, uint64_t out_size)
     {
         this->in_size = in_size;
         this->out_size = out_size;
         vals = new std::vector< KCV, Allocator<KCV> >[in_size * out_size];
+        cache_hits.assign(in_size, 0);
+        cache_misses.assign(in_size, 0);
+    }
+
+    // Number of front cache entries in each per-thread table, 0 disables.
+    void set_front_cache(uint64_t entries)
+    {
+        cache_size = entries;
+    }
+
+    // A key whose weight (number of values for the reducer) exceeds 
+    // FRACTION of an average partition's weight is moved to a partition
+    // of its own by prepare_reduce(). 0 disables.
+    void set_hot_keys(double fraction)
+    {
+        hot_fraction = fraction;
+    }
+
+    // The default partitioner.
+    uint64_t partition(K const& key, uint64_t partitions) const
+    {
+        Hash kh;
+        return kh(key) % partitions;
+    }
+
+    // Front cache hits and misses summed over all threads of the last run.
+    void front_cache_stats(uint64_t& hits, uint64_t& misses) const
+    {
+        hits = misses = 0;
+        for(uint64_t i = 0; i < cache_hits.size(); i++) {
+            hits += cache_hits[i];
+            misses += cache_misses[i];
+        }
     }
  
     virtual ~hash_container() 
@@ -172,18 +280,113 @@ public:
     
     input_type get(uint64_t in_index)
     {
-        input_type i;
+        input_type i(cache_size);
         return i;
     }
 
-    void add(uint64_t in_index, input_type const& j)
+    // PART(key, partitions) picks the reduce partition of every key.
+    template<class Partitioner>
+    void add(uint64_t in_index, input_type& j, Partitioner const& part)
     {
-        Hash kh;
+        j.flush();
+        cache_hits[in_index] += j.hits();
+        cache_misses[in_index] += j.misses();
+
         for(typename input_type::const_iterator i = j.begin(); i != j.end(); ++i)
         {
             if(!(*i).second.empty())
-                vals[(kh((*i).first)%out_size)*in_size + in_index].push_back(*i);
+                vals[part((*i).first, out_size)*in_size + in_index].push_back(*i);
+        }
+    }
+
+    /* Called once after the map phase. Returns the number of reduce 
+       partitions, which grows by one for every hot key split off. Every 
+       thread's table could hold a share of a hot key, but a key heavier 
+       than the threshold overall must exceed threshold / in_size in at 
+       least one of them, which keeps the candidate set small. */
+    template<class Partitioner>
+    uint64_t prepare_reduce(Partitioner const& part)
+    {
+        if(hot_fraction <= 0)
+            return out_size;
+
+        uint64_t total = 0;
+        for(uint64_t i = 0; i < in_size * out_size; i++)
+            for(size_t j = 0; j < vals[i].size(); j++)
+                total += vals[i][j].second.weight();
+        uint64_t threshold = std::max((uint64_t)1, 
+            (uint64_t)(hot_fraction * total / out_size));
+
+        std::tr1::unordered_map<K, uint64_t, Hash> hot;
+        for(uint64_t i = 0; i < in_size * out_size; i++)
+            for(size_t j = 0; j < vals[i].size(); j++)
+                if(vals[i][j].second.weight() * in_size > threshold)
+                    hot[vals[i][j].first] = 0;
+        if(hot.empty())
+            return out_size;
+
+        // Sum up the candidates' weights, only their home partitions 
+        // need to be looked at.
+        std::vector<bool> home(out_size, false);
+        typename std::tr1::unordered_map<K, uint64_t, Hash>::iterator h;
+        for(h = hot.begin(); h != hot.end(); ++h)
+            home[part(h->first, out_size)] = true;
+        for(uint64_t p = 0; p < out_size; p++) {
+            if(!home[p]) continue;
+            for(uint64_t i = 0; i < in_size; i++) {
+                std::vector< KCV, Allocator<KCV> >& v = vals[p*in_size + i];
+                for(size_t j = 0; j < v.size(); j++)
+                    if((h = hot.find(v[j].first)) != hot.end())
+                        h->second += v[j].second.weight();
+            }
+        }
+
+        // Number the keys that are really hot, drop the rest.
+        uint64_t parts = out_size;
+        for(h = hot.begin(); h != hot.end(); ) {
+            if(h->second > threshold)
+                (h++)->second = parts++;
+            else
+                h = hot.erase(h);
+        }
+        if(parts == out_size)
+            return out_size;
+
+        std::vector< KCV, Allocator<KCV> >* v = 
+            new std::vector< KCV, Allocator<KCV> >[in_size * parts];
+        for(uint64_t i = 0; i < in_size * out_size; i++)
+            v[i].swap(vals[i]);
+        delete [] vals;
+        vals = v;
+
+        // Move the hot keys out of their home partitions.
+        for(uint64_t p = 0; p < out_size; p++) {
+            if(!home[p]) continue;
+            for(uint64_t i = 0; i < in_size; i++) {
+                std::vector< KCV, Allocator<KCV> >& part = vals[p*in_size + i];
+                size_t k = 0;
+                for(size_t j = 0; j < part.size(); j++) {
+                    if((h = hot.find(part[j].first)) != hot.end())
+                        vals[h->second*in_size + i].push_back(part[j]);
+                    else
+                        part[k++] = part[j];
+                }
+                part.erase(part.begin() + k, part.end());
+            }
         }
+
+        dprintf("Split off %lu hot keys\n", parts - out_size);
+        out_size = parts;
+        return out_size;
+    }
+
+    // Work in reduce partition OUT_INDEX, the number of entries to merge.
+    uint64_t partition_size(uint64_t out_index) const
+    {
+        uint64_t size = 0;
+        for(uint64_t i = 0; i < in_size; i++)
+            size += vals[out_index*in_size + i].size();
+        return size;
     }
 
     class iterator
@@ -228,6 +431,54 @@ public:
     }
 };
 
+// Keys 0..N-1 of the array containers grouped by reduce partition. Only
+// filled in for a custom partitioner, by default partition P holds keys 
+// P, P + partitions, ...
+class key_groups
+{
+    std::vector<uint64_t> keys;         // grouped by partition
+    std::vector<uint64_t> offsets;      // where each group starts
+public:
+    template<class Partitioner>
+    void group(uint64_t n, uint64_t partitions, Partitioner const& part)
+    {
+        std::vector<uint64_t> p(n);
+        offsets.assign(partitions + 1, 0);
+        for(uint64_t i = 0; i < n; i++) {
+            p[i] = part(i, partitions);
+            offsets[p[i] + 1]++;
+        }
+        for(uint64_t i = 0; i < partitions; i++)
+            offsets[i + 1] += offsets[i];
+
+        std::vector<uint64_t> next(offsets.begin(), offsets.end() - 1);
+        keys.resize(n);
+        for(uint64_t i = 0; i < n; i++)
+            keys[next[p[i]]++] = i;
+    }
+
+    void clear()
+    {
+        keys.clear();
+        offsets.clear();
+    }
+
+    uint64_t size(uint64_t n, uint64_t partitions, uint64_t p) const
+    {
+        if(!offsets.empty())
+            return offsets[p + 1] - offsets[p];
+        return p < n ? (n - p + partitions - 1) / partitions : 0;
+    }
+
+    // The K-th key of partition P, N if there is none.
+    uint64_t key(uint64_t n, uint64_t partitions, uint64_t p, uint64_t k) const
+    {
+        if(!offsets.empty())
+            return k < offsets[p + 1] - offsets[p] ? keys[offsets[p] + k] : n;
+        return std::min(n, p + k * partitions);
+    }
+};
+
 // Storage for fixed cardinality keys
 template<typename K, typename V, 
 	template<typename, template<class> class> class Combiner, int N, 
@@ -237,6 +488,7 @@ class array_container
 private:
     Combiner<V, Allocator>* vals;
     uint64_t in_size, out_size;
+    key_groups keys;
 public:
 
     typedef K key_type;
@@ -252,6 +504,34 @@ public:
         this->in_size = in_size;
         this->out_size = out_size;
         vals = new Combiner<V, Allocator>[this->in_size * N];
+        keys.clear();
+    }
+
+    // By default partition OUT_INDEX holds keys OUT_INDEX, 
+    // OUT_INDEX + out_size, ...
+    uint64_t partition(K const& key, uint64_t partitions) const
+    {
+        return (uint64_t)key % partitions;
+    }
+
+    template<class Partitioner>
+    void add(uint64_t in_index, input_type const& j, Partitioner const&)
+    {
+        add(in_index, j);
+    }
+
+    // A custom partitioner gets every key's partition looked up once.
+    template<class Partitioner>
+    uint64_t prepare_reduce(Partitioner const& part)
+    {
+        if(part.custom)
+            keys.group(N, out_size, part);
+        return out_size;
+    }
+
+    uint64_t partition_size(uint64_t out_index) const
+    {
+        return keys.size(N, out_size, out_index) * in_size;
     }
  
     virtual ~array_container() 
@@ -284,13 +564,14 @@ public:
     {
     private:
         array_container<K, V, Combiner, N, Allocator> const* ac;
-        uint64_t index, i;
+        uint64_t index, k;
     public:
         iterator(array_container const* ac, uint64_t index) : 
-            ac(ac), index(index), i(index) {}
+            ac(ac), index(index), k(0) {}
        
         bool next(K& key, output_type& values)
         {
+            uint64_t i = ac->keys.key(N, ac->out_size, index, k++);
             if(i >= N)
                 return false;
             key = (K)i;
@@ -300,7 +581,6 @@ public:
                 if(!ac->vals[i*ac->in_size+j].empty())
                     values.add(&ac->vals[i*ac->in_size+j]);
             }
-            i += ac->in_size;	// XXX: in_size == num reduce threads
             return true;
         }
     };
@@ -321,6 +601,7 @@ class common_array_container
 private:
     Combiner<V, Allocator>* vals;
     uint64_t in_size, out_size;
+    key_groups keys;
 public:
 
     typedef K key_type;
@@ -340,6 +621,31 @@ public:
         {
 	    vals[i] = Combiner<V, Allocator>();
         }
+        keys.clear();
+    }
+
+    uint64_t partition(K const& key, uint64_t partitions) const
+    {
+        return (uint64_t)key % partitions;
+    }
+
+    template<class Partitioner>
+    void add(uint64_t in_index, input_type const& j, Partitioner const&)
+    {
+        add(in_index, j);
+    }
+
+    template<class Partitioner>
+    uint64_t prepare_reduce(Partitioner const& part)
+    {
+        if(part.custom)
+            keys.group(N, out_size, part);
+        return out_size;
+    }
+
+    uint64_t partition_size(uint64_t out_index) const
+    {
+        return keys.size(N, out_size, out_index);
     }
  
     virtual ~common_array_container() 
@@ -361,19 +667,19 @@ public:
     {
     private:
         common_array_container<K, V, Combiner, N, Allocator> const* ac;
-        uint64_t index, i;
+        uint64_t index, k;
     public:
         iterator(common_array_container const* ac, uint64_t index) : 
-            ac(ac), index(index), i(index) {}
+            ac(ac), index(index), k(0) {}
        
         bool next(K& key, output_type& values)
         {
+            uint64_t i = ac->keys.key(N, ac->out_size, index, k++);
             if(i >= N)
                 return false;
             key = (K)i;
             values.clear();
             values.add(&ac->vals[i]);
-            i += ac->in_size;
             return true;
         }
     };
@@ -455,9 +761,40 @@ public:
     void init(uint64_t in_size, uint64_t out_size)
     {
         this->in_size = in_size;
-        this->out_size = out_size;
+        // every partition needs a bucket of its own.
+        this->out_size = std::min(out_size, (uint64_t)N);
         hash_tables = new hash_table[in_size];
     }
+
+    // Partition OUT_INDEX covers buckets [first_bucket(OUT_INDEX), 
+    // first_bucket(OUT_INDEX+1)) of every table.
+    uint64_t first_bucket(uint64_t out_index) const
+    {
+        return std::min(out_index, out_size) * N / out_size;
+    }
+
+    // By default a key belongs to the partition covering its bucket.
+    uint64_t partition(K const& key, uint64_t partitions) const
+    {
+        Hash kh;
+        return ((kh(key) % N + 1) * partitions - 1) / N;
+    }
+
+    template<class Partitioner>
+    uint64_t prepare_reduce(Partitioner const&)
+    {
+        return out_size;
+    }
+
+    uint64_t partition_size(uint64_t out_index) const
+    {
+        uint64_t size = 0;
+        for(uint64_t b = first_bucket(out_index); 
+            b < first_bucket(out_index + 1); b++)
+            for(uint64_t i = 0; i < in_size; i++)
+                size += hash_tables[i].buckets[b]->size();
+        return size;
+    }
  
     virtual ~fixed_hash_container() 
     {
@@ -472,6 +809,30 @@ public:
             table.buckets[i] = j.buckets[i];
         }
     }
+
+    // A custom partitioner moves every entry into a bucket of its 
+    // partition's range, the same one for a key in every table.
+    template<class Partitioner>
+    void add(uint64_t in_index, input_type const& j, Partitioner const& part)
+    {
+        add(in_index, j);
+        if(!part.custom)
+            return;
+
+        Hash kh;
+        hash_bucket** buckets = hash_tables[in_index].buckets;
+        for(int i = 0; i < N; ++i) {
+            typename hash_bucket::iterator e = buckets[i]->begin();
+            while(e != buckets[i]->end()) {
+                uint64_t p = part(e->first, out_size);
+                uint64_t first = first_bucket(p);
+                uint64_t b = first + kh(e->first) % (first_bucket(p + 1) - first);
+                typename hash_bucket::iterator cur = e++;
+                if(b != (uint64_t)i)
+                    buckets[b]->splice(buckets[b]->end(), *buckets[i], cur);
+            }
+        }
+    }
     
     input_type get(uint64_t in_index)
     {
@@ -490,40 +851,24 @@ public:
     public:
         iterator(fixed_hash_container const* fc, uint64_t index) : fc(fc)
         {
-            if(index < N)
+            begin_idx = fc->first_bucket(index);
+            end_idx = fc->first_bucket(index + 1);
+
+            // hash merge 
+            for(size_t bucket_idx = begin_idx; bucket_idx < end_idx; 
+                bucket_idx++)
             {
-                // Calculate bucket range
-                size_t buckets_per_task = N / fc->out_size;
-                if(buckets_per_task == 0) 
-                    buckets_per_task = 1;
-                size_t remainder = N % fc->out_size;
-                begin_idx = buckets_per_task * index;
-                if(index < remainder) {
-                    begin_idx += index;
-                } else {
-                    begin_idx += remainder;
-                }
-                end_idx = begin_idx + buckets_per_task;
-                if(index < remainder) {
-                    end_idx += 1;
-                }
-                
-                // hash merge 
-                for(size_t bucket_idx = begin_idx; bucket_idx < end_idx; 
-                    bucket_idx++)
+                for(uint64_t i = 0; i < fc->in_size; i++)
                 {
-                    for(uint64_t i = 0; i < fc->in_size; i++)
+                    input_type& table = fc->hash_tables[i];
+                    hash_bucket* bucket = table.buckets[bucket_idx];
+                    typename hash_bucket::iterator j;
+
+                    for(j = bucket->begin(); j != bucket->end(); j++)
                     {
-                        input_type& table = fc->hash_tables[i];
-                        hash_bucket* bucket = table.buckets[bucket_idx];
-                        typename hash_bucket::iterator j;
-
-                        for(j = bucket->begin(); j != bucket->end(); j++)
-                        {
-                            combined[j->first].add(&j->second);
-                        }
-                        
+                        combined[j->first].add(&j->second);
                     }
+                    
                 }
             }
             this->i = combined.begin();
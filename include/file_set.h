@@ -0,0 +1,159 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef FILE_SET_H_
+#define FILE_SET_H_
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+#include "stddefines.h"
+#include "prefetch_reader.h"
+#include "stream_reader.h"
+#include "zblock.h"
+
+/* A corpus of files as MapReduce input, e.g. a directory of documents.
+   split() is a splitter for it: it packs consecutive small files into one
+   chunk and cuts large files into pieces of about CHUNK_SIZE bytes at 
+   whitespace. Every piece remembers its file and its offset in it, so 
+   that results can be attributed to documents. 
+
+   Files are mapped read-only when a map task first asks for one of their
+   pieces, and the pages of a large file's next piece are read ahead while
+   the current one is mapped, so reading overlaps with mapping. split() 
+   only maps large files, to find the whitespace to cut at. The mapped 
+   files stay valid until the file_set is destroyed, so keys may point 
+   into them. Streams are the exception: a map task releases its pieces
+   of one once it is done with them, see release(). */
+class file_set
+{
+public:
+    // Part of a file, or all of it.
+    struct piece {
+        char const* data;
+        uint64_t    len;
+        uint32_t    file;       // index of the file
+        uint64_t    offset;     // of DATA within the file
+        uint64_t    avail;      // bytes from DATA on in memory, LEN or more
+    };
+
+    // The input of one map task: pieces FIRST to FIRST + COUNT - 1, which 
+    // are numbered in file order.
+    struct chunk {
+        uint64_t    first;
+        uint64_t    count;
+    };
+
+    file_set(uint64_t chunk_size = 1 << 20);
+    ~file_set();
+
+    // Add a file, or all regular files below a directory in name order.
+    // Returns false if PATH cannot be read.
+    bool add(char const* path);
+
+    // Whether PATH is a block-compressed file, which only add(PATH) reads.
+    static bool compressed(char const* path);
+
+    // Add a file that is already in memory under NAME. MAPPED says that 
+    // DATA is a mapping of the file, so that reading ahead pays.
+    void add(char const* name, char const* data, uint64_t size, 
+        bool mapped = false);
+
+    // Add a file that READER is still reading in. The splitter waits for
+    // the data it hands out.
+    void add(char const* name, prefetch_reader& reader);
+
+    // Add a stream, e.g. standard input. Its size is what has been split
+    // so far.
+    void add(char const* name, stream_reader& reader);
+
+    // Whether FILE is a stream, whose pieces go away once released, so 
+    // that keys must not point into them.
+    bool streamed(uint32_t file) const { return files[file].stream != NULL; }
+
+    uint32_t num_files() const { return files.size(); }
+    char const* name(uint32_t file) const { return files[file].name.c_str(); }
+    uint64_t size(uint32_t file) const { return files[file].size; }
+
+    // The splitter, returns false once all files are handed out.
+    bool split(chunk& out);
+
+    uint64_t num_pieces() const { return pieces.size(); }
+
+    // Piece INDEX of those made by split(), mapping its file or 
+    // decompressing it if needed.
+    piece get(uint64_t index);
+
+    // Done with piece INDEX. The memory of a stream's piece is reused, 
+    // its data must not be looked at any more; other pieces stay.
+    void release(uint64_t index);
+
+    // The data of CHUNK if it is in memory already, else NULL.
+    char const* address(chunk const& c) const;
+
+private:
+    struct file_t {
+        std::string     name;
+        uint64_t        size;       // of the text
+        uint64_t        map_size;   // of the file as mapped by us
+        char const*     data;
+        bool            owned;      // mapped by us
+        bool            mapped;
+        prefetch_reader* reader;    // still reading it in, or NULL
+        stream_reader*  stream;     // a stream, or NULL
+        std::vector<zblock_entry> blocks;   // if compressed
+    };
+    struct piece_t {
+        uint32_t        file;
+        uint64_t        offset;
+        uint64_t        len;
+        char const*     data;       // of a stream or a decompressed
+        uint64_t        avail;      // block, and the bytes in memory
+        uint64_t        block;      // of a compressed file
+    };
+
+    uint64_t                chunk_size;
+    std::vector<file_t>     files;
+    std::vector<piece_t>    pieces;
+    uint32_t                next_file;      // splitter position
+    uint64_t                next_offset;    // ... or block
+    pthread_mutex_t         mutex;
+
+    bool add_dir(std::string const& path);
+    char const* load(uint32_t file);
+    uint64_t wait(uint32_t file, uint64_t end);
+    bool split_stream(chunk& out);
+    bool split_block(chunk& out);
+    char const* decompress(uint64_t index, piece_t& p);
+    void push(piece_t const& p);
+    void read_ahead(piece_t const& p, piece_t const& next) const;
+};
+
+#endif /* FILE_SET_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
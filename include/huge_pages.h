@@ -0,0 +1,106 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef HUGE_PAGES_H_
+#define HUGE_PAGES_H_
+
+#include <stddef.h>
+#include <new>
+#include <limits>
+
+/* Huge page backing for large buffers and tables, which otherwise spread
+   random accesses over so many 4 KB pages that the TLB cannot keep up.
+   It is off unless MR_HUGEPAGES=1 is set. Then allocations of at least 
+   MR_HUGE_PAGE_SIZE bytes come from explicit huge pages (MAP_HUGETLB) 
+   if the system has any reserved, or else from anonymous memory aligned
+   to huge pages and marked for transparent huge pages. Smaller ones, and
+   all of them where neither is available, come from malloc. */
+
+// Whether MR_HUGEPAGES=1 was set when first asked.
+bool huge_pages_enabled ();
+
+void* huge_alloc (size_t size);
+
+// SIZE must be the size given to huge_alloc.
+void huge_free (void* ptr, size_t size);
+
+/* An allocator for the containers' and combiners' Allocator parameter 
+   that places their large vectors on huge pages. */
+template<class T>
+class huge_page_allocator
+{
+public:
+    typedef T               value_type;
+    typedef T*              pointer;
+    typedef T const*        const_pointer;
+    typedef T&              reference;
+    typedef T const&        const_reference;
+    typedef size_t          size_type;
+    typedef ptrdiff_t       difference_type;
+
+    template<class U> struct rebind { typedef huge_page_allocator<U> other; };
+
+    huge_page_allocator() {}
+    template<class U> huge_page_allocator(huge_page_allocator<U> const&) {}
+
+    pointer address(reference x) const { return &x; }
+    const_pointer address(const_reference x) const { return &x; }
+
+    pointer allocate(size_type n, void const* = 0)
+    {
+        if (n > max_size())
+            throw std::bad_alloc();
+        void* p = huge_alloc (n * sizeof(T));
+        if (p == NULL && n > 0)
+            throw std::bad_alloc();
+        return static_cast<pointer>(p);
+    }
+
+    void deallocate(pointer p, size_type n)
+    {
+        huge_free (p, n * sizeof(T));
+    }
+
+    size_type max_size() const 
+    { 
+        return std::numeric_limits<size_type>::max() / sizeof(T); 
+    }
+
+    void construct(pointer p, T const& val) { new((void*)p) T(val); }
+    void destroy(pointer p) { p->~T(); }
+};
+
+template<class T, class U>
+inline bool operator==(huge_page_allocator<T> const&, 
+    huge_page_allocator<U> const&) { return true; }
+template<class T, class U>
+inline bool operator!=(huge_page_allocator<T> const&, 
+    huge_page_allocator<U> const&) { return false; }
+
+#endif /* HUGE_PAGES_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,190 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef INDEX_FILE_H_
+#define INDEX_FILE_H_
+
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "result_file.h"
+
+/* A persistent inverted index: for every word of a corpus, the lines it
+   occurs on, and where in the files it occurs for phrase queries. A file
+   has a header, the names of the corpus files, the posting lists, the 
+   hit lists, and a result file (see result_file.h) of the words with 
+   where their lists are, starting at a page boundary. A posting is a 
+   file and a line in it, see index_posting. Every word's postings are 
+   sorted, and stored as the differences between them in variable-length
+   bytes of 7 bits. A hit is the file and the number of the word in it,
+   in the same form, with the hit's line. Hits are sorted and stored as
+   the difference to the last hit followed by the line, which within a 
+   file is the difference to the last line too. Integers are in host 
+   byte order. */
+#define INDEX_MAGIC "PHXIDX02"
+#define INDEX_LINE_BITS 40
+
+struct index_header
+{
+    char        magic[8];
+    uint64_t    num_files;
+    uint64_t    names_at;       // NUL-terminated, one after another
+    uint64_t    names_size;
+    uint64_t    postings_at;
+    uint64_t    postings_size;
+    uint64_t    hits_at;
+    uint64_t    hits_size;
+    uint64_t    terms_at;
+    uint64_t    terms_size;
+};
+
+// The value of a word in the terms.
+struct index_term
+{
+    uint64_t    offset;         // of its postings
+    uint64_t    count;          // of its postings
+    uint64_t    hits_offset;
+    uint64_t    hits_count;
+};
+
+// Where a word occurs, see above.
+struct index_hit
+{
+    uint64_t    pos;            // an index_posting of file and word
+    uint64_t    line;
+
+    bool operator<(index_hit const& other) const { return pos < other.pos; }
+};
+
+inline uint64_t index_posting (uint64_t file, uint64_t line)
+{
+    return (file << INDEX_LINE_BITS) | line;
+}
+inline uint64_t index_file_of (uint64_t posting)
+{
+    return posting >> INDEX_LINE_BITS;
+}
+inline uint64_t index_line_of (uint64_t posting)
+{
+    return posting & ((1ULL << INDEX_LINE_BITS) - 1);
+}
+
+// Append the sorted postings of one word to OUT.
+void index_encode (uint64_t const* postings, uint64_t count, 
+    std::vector<char>& out);
+// ... and of its sorted hits.
+void index_encode (index_hit const* hits, uint64_t count, 
+    std::vector<char>& out);
+
+// Reads an index through a read-only mapping.
+class index_file
+{
+public:
+    index_file() : map(NULL), map_size(0) {}
+    ~index_file() { close(); }
+
+    // Returns false if PATH cannot be mapped or is no index.
+    bool open(char const* path);
+    void close();
+
+    uint64_t num_files() const { return names.size(); }
+    char const* file_name(uint64_t file) const { return names[file]; }
+    uint64_t num_terms() const { return terms.size(); }
+    result_file const& term_file() const { return terms; }
+
+    // The postings of WORD, as stored, e.g. upper case, into OUT. Returns
+    // false if there are none.
+    bool lookup(char const* word, uint64_t len, 
+        std::vector<uint64_t>& out) const;
+    // ... and the postings of term I.
+    void postings(uint64_t i, std::vector<uint64_t>& out) const;
+    // The hits of WORD, or of term I, in order.
+    bool hits(char const* word, uint64_t len, 
+        std::vector<index_hit>& out) const;
+    void hits(uint64_t i, std::vector<index_hit>& out) const;
+    // How many postings WORD has.
+    uint64_t count(char const* word, uint64_t len) const;
+
+private:
+    char const*                 map;
+    uint64_t                    map_size;
+    std::vector<char const*>    names;
+    char const*                 post;
+    uint64_t                    post_size;
+    char const*                 hit;
+    uint64_t                    hit_size;
+    result_file                 terms;
+};
+
+/* Writes an index of the corpus files NAMES, with their encoded POSTINGS,
+   HITS and TERMS, keyvals of str_keys and index_terms. The terms are sorted 
+   and written on THREADS threads of POOL. Returns false on errors, see 
+   errno. */
+template<class KV>
+bool index_write (char const* path, std::vector<std::string> const& names,
+    std::vector<char> const& postings, std::vector<char> const& hits,
+    std::vector<KV> const& terms,
+    thread_pool* pool, int threads)
+{
+    int fd = ::open (path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    std::string blob;
+    for (size_t i = 0; i < names.size(); ++i)
+        blob.append(names[i].c_str(), names[i].size() + 1);
+
+    uint64_t page = sysconf (_SC_PAGESIZE);
+    index_header h;
+    memcpy (h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.num_files = names.size();
+    h.names_at = sizeof(h);
+    h.names_size = blob.size();
+    h.postings_at = h.names_at + h.names_size;
+    h.postings_size = postings.size();
+    h.hits_at = h.postings_at + h.postings_size;
+    h.hits_size = hits.size();
+    h.terms_at = (h.hits_at + h.hits_size + page - 1) / page * page;
+
+    result_writer<KV> writer (pool, threads);
+    bool ok = pwrite (fd, blob.data(), blob.size(), h.names_at) == 
+            (ssize_t)blob.size() &&
+        (postings.empty() || pwrite (fd, &postings[0], postings.size(), 
+            h.postings_at) == (ssize_t)postings.size()) &&
+        (hits.empty() || pwrite (fd, &hits[0], hits.size(), 
+            h.hits_at) == (ssize_t)hits.size()) &&
+        writer.write (fd, h.terms_at, terms, h.terms_size) &&
+        pwrite (fd, &h, sizeof(h), 0) == sizeof(h);
+
+    return ::close (fd) == 0 && ok;
+}
+
+#endif /* INDEX_FILE_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
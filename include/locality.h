@@ -28,7 +28,9 @@
 #define LOCALITY_H_
 
 #include <assert.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <algorithm>
 
 #if defined(_LINUX_) && defined(NUMA_SUPPORT)
 #include <numaif.h>
@@ -43,15 +45,16 @@
 
 #include "stddefines.h"
 #include "processor.h"
+#include "topology.h"
 
-/* Retrieve the number of total locality groups on system. */
+/* Retrieve the number of total locality groups on system. On Linux the
+   groups are the NUMA nodes in sysfs (see cpu_topology), with or without
+   libnuma; NUMA_SUPPORT only adds the memory placement calls below. */
 inline int loc_get_num_lgrps ()
 {
-#if defined(_LINUX_) && defined(NUMA_SUPPORT)
-    static int max = -1;
-    if(max < 0)
-        max = numa_max_node() + 1;
-    return max;
+#if defined(_LINUX_)
+    int nodes = cpu_topology::get().num_nodes();
+    return nodes > 0 ? nodes : 1;
 #elif defined (_SOLARIS_) && defined(NUMA_SUPPORT)
     int ret;
     lgrp_cookie_t cookie;
@@ -78,10 +81,9 @@ inline int loc_get_num_lgrps ()
 /* Retrieve the locality group of the calling LWP. */
 inline int loc_get_lgrp ()
 {
-#if defined(_LINUX_) && defined(NUMA_SUPPORT)
-    // assumes locality groups are adjacent and the same size. 
-    // Need to figure out if there is a better way to get this info.
-    return proc_get_cpuid() / (proc_get_num_cpus() / loc_get_num_lgrps());
+#if defined(_LINUX_)
+    // Node numbering need not follow CPU numbering, use the node map.
+    return cpu_topology::get().node_of(proc_get_cpuid());
 #elif defined (_SOLARIS_) && defined(NUMA_SUPPORT)
     int lgrp = lgrp_home (P_LWPID, P_MYID);
 
@@ -98,13 +100,49 @@ inline int loc_get_lgrp ()
 #endif
 }
 
+/* Spread the pages of [ADDR, ADDR+LEN) over the locality groups, one 
+   contiguous slice per group, so that consecutive chunks of an input 
+   buffer are mapped near their data (see loc_mem_to_lgrp). Only pages 
+   that have not been touched yet are placed, so call it right after 
+   allocating the buffer and before filling it. */
+inline void loc_spread_mem (void* addr, size_t len)
+{
+#if defined(_LINUX_) && defined(NUMA_SUPPORT)
+    int lgrps = loc_get_num_lgrps ();
+    if (lgrps <= 1 || lgrps > 1024)
+        return;
+
+    uintptr_t page = sysconf (_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)addr & ~(page - 1);
+    uintptr_t end = (uintptr_t)addr + len;
+    uintptr_t slice = ((end - begin) / lgrps + page - 1) & ~(page - 1);
+
+    for (int lgrp = 0; lgrp < lgrps && begin < end; ++lgrp, begin += slice)
+    {
+        unsigned long mask[1024 / (8 * sizeof(unsigned long))] = { 0 };
+        mask[lgrp / (8 * sizeof(unsigned long))] = 
+            1UL << (lgrp % (8 * sizeof(unsigned long)));
+        // Preferred rather than bound, a full node is not an error.
+        mbind ((void*)begin, std::min(slice, end - begin), MPOL_PREFERRED, 
+            mask, 1024, 0);
+    }
+#elif defined(_SOLARIS_) && defined(NUMA_SUPPORT)
+    madvise ((caddr_t)addr, len, MADV_ACCESS_MANY);
+#endif
+}
+
 /* Retrieve the locality group of the physical memory that backs
-   the virtual address ADDR. */
+   the virtual address ADDR, or -1 if that is not known (e.g. ADDR is
+   NULL because the data is not loaded yet). */
 inline int loc_mem_to_lgrp (void const* addr)
 {
+    if (addr == NULL)
+        return -1;
 #if defined(_LINUX_) && defined(NUMA_SUPPORT)
     int mode;
-    get_mempolicy(&mode, NULL, 0, (void*)addr, MPOL_F_NODE | MPOL_F_ADDR);
+    if (get_mempolicy(&mode, NULL, 0, (void*)addr, 
+        MPOL_F_NODE | MPOL_F_ADDR) < 0)
+        return -1;
     return mode;
 #elif defined(_SOLARIS_) && defined(NUMA_SUPPORT)
     uint_t info = MEMINFO_VLGRP;
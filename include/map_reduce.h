@@ -33,6 +33,7 @@
 #include <queue>
 #include <limits>
 #include <cmath>
+#include <functional>
 
 #include "stddefines.h"
 #include "processor.h"
@@ -42,6 +43,9 @@
 #include "container.h"
 #include "locality.h"
 #include "thread_pool.h"
+#include "perf_counter.h"
+#include "huge_pages.h"
+#include "result_file.h"
 
 template<typename Impl, typename D, typename K, typename V, 
     class Container = hash_container<K, V, buffer_combiner> >
@@ -69,9 +73,20 @@ protected:
     // Parameters.
     uint64_t num_threads;               // # of threads to run.
     uint64_t thread_offset;             // cores to skip when assigning threads.
+    uint64_t thread_slots;              // size of per-thread structures, 
+                                        // i.e. the pool's capacity.
+    uint64_t reduce_partitions;         // reduce partitions per thread.
 
     thread_pool* threadPool;            // Thread pool.
+    bool own_pool;                      // created by setThreads.
+    int elastic;                        // for the pool, -1 leaves it be.
     task_queue* taskQueue;              // Queues of tasks.
+    lock::lock_type lock_type;          // Task queue lock implementation.
+    bool profile_locks;                 // Report task queue lock contention.
+    bool count_node_loads;              // Report local and remote loads.
+    bool streaming;                     // Split while mapping.
+    bool split_done;                    // ... and the splitter ran dry.
+    pthread_mutex_t split_lock;         // ... held around the splitter.
 
     container_type container; 
     std::vector<keyval>* final_vals;    // Array to send to merge task.    
@@ -99,19 +114,27 @@ protected:
         double user_time;
         double time;        
         int tasks;
+        uint64_t loads;             // memory loads, if counted
+        uint64_t remote_loads;      // ... served by another node
     };
 
     static void map_callback(void* arg, thread_loc const& loc) { 
         thread_arg_t* t = (thread_arg_t*)arg; 
+        node_counter nc(t->mr->count_node_loads);
         t->mr->map_worker(loc, t->time, t->user_time, t->tasks); 
+        nc.read(t->loads, t->remote_loads);
     }
     static void reduce_callback(void* arg, thread_loc const& loc) { 
         thread_arg_t* t = (thread_arg_t*)arg; 
+        node_counter nc(t->mr->count_node_loads);
         t->mr->reduce_worker(loc, t->time, t->user_time, t->tasks);
+        nc.read(t->loads, t->remote_loads);
     }
     static void merge_callback(void* arg, thread_loc const& loc) { 
         thread_arg_t* t = (thread_arg_t*)arg; 
+        node_counter nc(t->mr->count_node_loads);
         t->mr->merge_worker(loc, t->time, t->user_time, t->tasks); 
+        nc.read(t->loads, t->remote_loads);
     }
     void start_workers (void (*callback)(void*, thread_loc const&), 
         int num_threads, char const* stage);    
@@ -119,6 +142,16 @@ protected:
     // the default split function...
     int split(data_type &a) { return 0; }
 
+    // Next input from the splitter, when streaming.
+    bool split_next(data_type& chunk) {
+        pthread_mutex_lock(&this->split_lock);
+        if(!this->split_done)
+            this->split_done = !static_cast<Impl*>(this)->split(chunk);
+        bool done = this->split_done;
+        pthread_mutex_unlock(&this->split_lock);
+        return !done;
+    }
+
     // the default map function...
     void map(data_type const& a, map_container& m) const {}
     
@@ -133,41 +166,233 @@ protected:
         }
     }
 
+    // the default partitioner, defers to the container. Called with the 
+    // number of reduce partitions, returns the key's partition. Jobs can
+    // override it like the other hooks, e.g. with a range partitioner.
+    uint64_t partition(key_type const& key, uint64_t partitions) const {
+        return container.partition(key, partitions);
+    }
+
+    // The pool this job runs on, the shared one unless set otherwise. 
+    // Threads are only created when the first job needs them.
+    thread_pool* pool() {
+        if(this->threadPool == NULL)
+            this->threadPool = thread_pool::shared();
+        return this->threadPool;
+    }
+
+    // Passes the Impl's partition() to the container. CUSTOM tells the 
+    // containers that lay out keys by their own default whether they need
+    // to look at it at all. It is known at compile time: taking the
+    // address of an inherited partition() yields a pointer to member of 
+    // MapReduce, which picks the non-template overload of is_custom().
+    struct partitioner
+    {
+        Impl const* impl;
+        bool custom;
+        partitioner(MapReduce const* mr) : 
+            impl(static_cast<Impl const*>(mr)), 
+            custom(is_custom(&Impl::partition)) {}
+        uint64_t operator()(key_type const& key, uint64_t partitions) const {
+            return impl->partition(key, partitions);
+        }
+    };
+
+    typedef uint64_t (MapReduce::*default_partition)(
+        key_type const&, uint64_t) const;
+    static bool is_custom(default_partition) { return false; }
+    template<class C> static bool is_custom(
+        uint64_t (C::*)(key_type const&, uint64_t) const) { return true; }
+
     // the default locator function...
     void* locate(data_type* data, uint64_t) const {
         return (void*)data;
     }
 
+    // State of a job started by run_async().
+    struct async_job
+    {
+        pthread_t thread;
+        bool running;
+        volatile int done;
+        int ret;
+        data_type* data;                // NULL to run the splitter
+        uint64_t count;
+        std::vector<keyval>* result;
+    } async;
+
+    static void* async_main(void* arg) {
+        MapReduce* mr = (MapReduce*)arg;
+        async_job& job = mr->async;
+        job.ret = job.data != NULL ? 
+            mr->run(job.data, job.count, *job.result) : mr->run(*job.result);
+        asm("" ::: "memory");
+        job.done = 1;
+        return NULL;
+    }
+
+    int join_async() {
+        if(this->async.running) {
+            CHECK_ERROR (pthread_join(this->async.thread, NULL));
+            this->async.running = false;
+        }
+        return this->async.ret;
+    }
+
 public:
 
-    MapReduce() : threadPool(NULL), taskQueue(NULL) {
+    // Handle of a job started by run_async().
+    class future
+    {
+        MapReduce* mr;
+    public:
+        future(MapReduce* mr) : mr(mr) {}
+
+        // true once the job has finished.
+        bool ready() const { return mr->async.done != 0; }
+
+        // wait for the job to finish and return what run() returned.
+        int get() { return mr->join_async(); }
+    };
+
+    MapReduce() : reduce_partitions(16), threadPool(NULL), own_pool(false), 
+        elastic(-1), taskQueue(NULL) {
         // Determine the number of threads to use. 
         // First check for an environment variable, then use the 
         // number of processors
         int threads = atoi(GETENV("MR_NUMTHREADS"));
         setThreads(threads > 0 ? threads : proc_get_num_cpus(), 0);
+        if(getenv("MR_ELASTIC") != NULL)
+            setElastic(atoi(GETENV("MR_ELASTIC")) != 0);
+        setReducePartitions(atoi(GETENV("MR_REDUCE_PARTITIONS")));
+
+        // Task queue locks, e.g. MR_LOCK=ticket, and MR_LOCKSTATS=1 to 
+        // report their contention after every phase.
+        lock::lock_type type = lock::default_type();
+        char const* name = getenv("MR_LOCK");
+        if(name != NULL && !lock::parse_type(name, type))
+            fprintf(stderr, "Unknown lock type %s, using %s\n", name, 
+                lock::type_name(type));
+        setLocks(type, atoi(GETENV("MR_LOCKSTATS")) != 0);
+        setNodeStats(atoi(GETENV("MR_NODESTATS")) != 0);
+        setStreaming(atoi(GETENV("MR_STREAM")) != 0);
+        this->split_done = true;
+        CHECK_ERROR (pthread_mutex_init(&this->split_lock, NULL));
+
+        this->async.running = false;
+        this->async.ret = 0;
     }
 
     virtual ~MapReduce() {
-        if(this->threadPool != NULL) delete this->threadPool;
+        join_async();
+        if(this->own_pool) delete this->threadPool;
         if(this->taskQueue != NULL) delete this->taskQueue;
+        pthread_mutex_destroy(&this->split_lock);
     }
 
-    // override the default thread offset and thread count.
+    // override the default thread count. Jobs run on the shared pool 
+    // unless given a scheduling POLICY, which gets them a pool of their 
+    // own with that thread placement. On the shared pool the count only 
+    // limits how many of its threads a phase of this job uses. A private
+    // pool is resized in place if it has room, which is also allowed 
+    // while a job is running. Otherwise it is rebuilt, which must not 
+    // happen during a run.
     MapReduce& setThreads(int num_threads, sched_policy const* policy = NULL) {
         this->num_threads = (num_threads > 0) ? num_threads : this->num_threads;
+
+        if(this->own_pool && policy == NULL && 
+            this->num_threads <= (uint64_t)this->threadPool->max_threads()) {
+            this->threadPool->resize(this->num_threads);
+            return *this;
+        }
+
+        if(!this->own_pool && policy == NULL)
+            return *this;
         
-        if(this->threadPool != NULL) delete this->threadPool;
-        if(this->taskQueue != NULL) delete this->taskQueue;
+        if(this->own_pool) delete this->threadPool;
 
-        // Create thread pool and task queue
+        // Create thread pool, leaving room to grow to one thread per CPU.
         sched_policy_strand_fill default_policy(0);
         this->threadPool = new thread_pool(
-            num_threads, policy == NULL ? &default_policy : policy);
-        this->taskQueue = new task_queue(num_threads, num_threads);
+            this->num_threads, policy == NULL ? &default_policy : policy,
+            std::max((int)this->num_threads, proc_get_num_cpus()));
+        this->own_pool = true;
+
+        return *this;
+    }
+
+    // run on POOL instead of thread_pool::shared(). It may be shared 
+    // with other MapReduce instances and must outlive this one. Jobs 
+    // running at the same time share its threads fairly, so they do not
+    // oversubscribe the CPUs.
+    MapReduce& setThreadPool(thread_pool* pool) {
+        join_async();
+        if(this->own_pool) delete this->threadPool;
+        this->threadPool = pool;
+        this->own_pool = false;
+        this->num_threads = pool->size();
+        return *this;
+    }
+
+    // let the pool shrink and grow with CPU contention. Applied to the 
+    // pool when the next job starts.
+    MapReduce& setElastic(bool elastic) {
+        this->elastic = elastic;
+        return *this;
+    }
+
+    // select the task queue lock implementation for the following runs
+    // and whether to count lock contention per task queue.
+    MapReduce& setLocks(lock::lock_type type, bool profile = false) {
+        this->lock_type = type;
+        this->profile_locks = profile;
+        return *this;
+    }
+
+    // count every phase's loads from memory and how many of them went to
+    // another NUMA node, through the hardware counters where available.
+    MapReduce& setNodeStats(bool count) {
+        this->count_node_loads = count;
+        return *this;
+    }
 
+    // have run() without input call the splitter from the map tasks as 
+    // they need input, instead of splitting all of it first. Then map 
+    // starts while the splitter is still waiting for input, e.g. from 
+    // disk, but tasks are not placed near their data.
+    MapReduce& setStreaming(bool streaming) {
+        this->streaming = streaming;
         return *this;
     }
+
+    // Split the intermediate keys into this many reduce partitions per 
+    // thread. Partitions are scheduled largest first, so more of them 
+    // balance skewed key distributions better at some merging overhead.
+    MapReduce& setReducePartitions(uint64_t per_thread) {
+        this->reduce_partitions = per_thread > 0 ? 
+            per_thread : this->reduce_partitions;
+        return *this;
+    }
+
+    // Give keys that carry more than FRACTION of an average partition's
+    // values a reduce partition of their own. Only supported by 
+    // hash_container.
+    MapReduce& setHotKeys(double fraction) {
+        container.set_hot_keys(fraction);
+        return *this;
+    }
+
+    // Enable a per-thread front cache of the given number of entries in 
+    // the map container. Only supported by hash_container.
+    MapReduce& setFrontCache(uint64_t entries) {
+        container.set_front_cache(entries);
+        return *this;
+    }
+
+    // Front cache hits and misses of the last run.
+    void getFrontCacheStats(uint64_t& hits, uint64_t& misses) const {
+        container.front_cache_stats(hits, misses);
+    }
     
     /* The main MapReduce engine. This is the function called by the 
      * application. It is responsible for creating and scheduling all map 
@@ -182,6 +407,37 @@ public:
     // This version assumes that the split function is provided.
     int run(std::vector<keyval>& result);
 
+    /* Start run() on a thread of its own and return at once, so that the
+     * caller can prepare the next job's input meanwhile. DATA and RESULT 
+     * must stay valid until the future is ready. One job per instance 
+     * runs at a time, a new one first waits for the previous job.
+     */
+    future run_async(data_type *data, uint64_t count, 
+        std::vector<keyval>& result) {
+        join_async();
+        this->async.data = data;
+        this->async.count = count;
+        this->async.result = &result;
+        this->async.done = 0;
+        this->async.running = true;
+        CHECK_ERROR (pthread_create(&this->async.thread, NULL, 
+            async_main, this));
+        return future(this);
+    }
+
+    future run_async(std::vector<keyval>& result) {
+        return run_async(NULL, 0, result);
+    }
+
+    /* Write RESULT to PATH as a result file that can be mapped and 
+     * searched, see result_file.h, on this job's threads. Keys must be 
+     * str_keys and values plain data. Returns less than zero on errors.
+     */
+    int write_results(char const* path, std::vector<keyval> const& result) {
+        result_writer<keyval> writer(pool(), this->num_threads);
+        return writer.write(path, result) ? 0 : -1;
+    }
+
     void emit_intermediate(typename container_type::input_type& i, 
         key_type const& k, value_type const& v) const {
 	i[k].add(v);
@@ -197,6 +453,11 @@ run (std::vector<keyval>& result)
     uint64_t count;
     D chunk;
 
+    if (this->streaming) {
+        this->split_done = false;
+        return run(NULL, 0, result);
+    }
+
     // Run splitter to generate chunks
     get_time (begin);
     while (static_cast<Impl const*>(this)->split(chunk))
@@ -221,21 +482,32 @@ run (D *data, uint64_t count, std::vector<keyval>& result)
     // Compute task counts (should make this more adjustable) and then 
     // allocate storage
     this->num_map_tasks = std::min(count, this->num_threads) * 16;
-    this->num_reduce_tasks = this->num_threads;
+    this->num_reduce_tasks = this->num_threads * this->reduce_partitions;
     dprintf ("num_map_tasks = %d\n", num_map_tasks);
     dprintf ("num_reduce_tasks = %d\n", num_reduce_tasks);
 
-    container.init(this->num_threads, this->num_reduce_tasks);
-    this->final_vals = new std::vector<keyval>[this->num_threads];
-    for(uint64_t i = 0; i < this->num_threads; i++) {
-        // Try to avoid a reallocation. Very costly on Solaris.
-        this->final_vals[i].reserve(100);
-    }
+    this->thread_slots = pool()->max_threads();
+    if(this->elastic >= 0)
+        this->threadPool->set_elastic(this->elastic != 0);
+
+    // The task queue is spread over the threads we start with; threads 
+    // added later steal from it.
+    if(this->taskQueue != NULL) delete this->taskQueue;
+    this->taskQueue = new task_queue(this->num_threads, this->thread_slots,
+        this->lock_type, this->profile_locks);
+    // Sub-queue i belongs to thread i, tasks for a locality group go to 
+    // the queues of its threads.
+    for(uint64_t i = 0; i < this->num_threads; i++)
+        this->taskQueue->set_lgrp(i, pool()->lgrp_of(i));
+
+    container.init(this->thread_slots, this->num_reduce_tasks);
+    // Each reducing thread allocates its own output, see reduce_worker.
+    this->final_vals = new std::vector<keyval>[this->thread_slots];
     print_time_elapsed("library init", begin);
 
     // Run map tasks and get intermediate values
     get_time (begin);
-    run_map(&data[0], count);
+    run_map(data, count);
     print_time_elapsed("map phase", begin);
 
     dprintf("In scheduler, all map tasks are done, now scheduling reduce tasks\n");
@@ -269,7 +541,7 @@ void MapReduce<Impl, D, K, V, Container>::
 run_map (data_type* data, uint64_t count)
 {
     // Compute map task chunk size
-    uint64_t chunk_size = 
+    uint64_t chunk_size = this->num_map_tasks == 0 ? 1 :
         std::max(1, (int)ceil((double)count / this->num_map_tasks));
     
     // Generate tasks by splitting input data and add to queue.
@@ -289,7 +561,9 @@ run_map (data_type* data, uint64_t count)
         }
     }
 
-    start_workers (&map_callback, std::min(num_map_tasks, num_threads), "map"); 
+    // Streaming, every thread maps what the splitter hands out.
+    start_workers (&map_callback, !this->split_done ? 
+        num_threads : std::min(num_map_tasks, num_threads), "map"); 
 }
 
 /**
@@ -312,7 +586,16 @@ map_worker(thread_loc const& loc, double& time, double& user_time, int& tasks)
     	user_time += time_elapsed(user_begin);
     }
 
-    container.add(loc.thread, t);
+    // Streaming, take the rest of the input from the splitter.
+    data_type chunk;
+    while (split_next (chunk)) {
+        tasks++;
+    	timespec user_begin = get_time();
+        static_cast<Impl const*>(this)->map(chunk, t);
+    	user_time += time_elapsed(user_begin);
+    }
+
+    container.add(loc.thread, t, partitioner(this));
     time += time_elapsed(begin);
 }
 
@@ -322,12 +605,40 @@ map_worker(thread_loc const& loc, double& time, double& user_time, int& tasks)
 template<typename Impl, typename D, typename K, typename V, class Container>
 void MapReduce<Impl, D, K, V, Container>::run_reduce ()
 {
-    // Create tasks and enqueue...
+    // Hot keys may add partitions.
+    this->num_reduce_tasks = container.prepare_reduce(partitioner(this));
+
+    // Schedule longest processing time first: every partition, largest 
+    // first, goes to the sub-queue with the least work so far, which is 
+    // the queue of the thread that runs it unless stolen. Stealing takes
+    // from the back, i.e. the small partitions.
+    std::vector< std::pair<uint64_t, uint64_t> > parts(this->num_reduce_tasks);
+    for (uint64_t i = 0; i < this->num_reduce_tasks; ++i)
+        parts[i] = std::make_pair(container.partition_size(i), i);
+    std::sort(parts.begin(), parts.end(), 
+        std::greater< std::pair<uint64_t, uint64_t> >());
+
+    int queues = this->taskQueue->num_sub_queues();
+    std::vector<uint64_t> load(queues, 0);
     for (uint64_t i = 0; i < this->num_reduce_tasks; ++i) {
-        task_queue::task_t task = {    i, 0, i, 0 };
-        this->taskQueue->enqueue_seq(task, this->num_reduce_tasks);
+        int q = std::min_element(load.begin(), load.end()) - load.begin();
+        load[q] += parts[i].first;
+        task_queue::task_t task = { parts[i].second, parts[i].first, 
+            parts[i].second, 0 };
+        this->taskQueue->enqueue_seq_to(task, q);
     }
 
+#ifdef TIMING
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < this->num_reduce_tasks; ++i)
+        total += parts[i].first;
+    fprintf (stderr, "reduce partitions: %lu, largest %lu of %lu entries, "
+        "queue loads %lu to %lu\n", this->num_reduce_tasks, 
+        parts.empty() ? 0 : parts[0].first, total, 
+        *std::min_element(load.begin(), load.end()),
+        *std::max_element(load.begin(), load.end()));
+#endif
+
     start_workers (&reduce_callback, 
         std::min(this->num_reduce_tasks, num_threads), "reduce");
 }
@@ -341,6 +652,11 @@ void MapReduce<Impl, D, K, V, Container>::reduce_worker (
 {
     timespec begin = get_time();
 
+    // Try to avoid a reallocation. Very costly on Solaris. Allocating 
+    // here puts the values on this thread's node.
+    if(this->final_vals[loc.thread].capacity() == 0)
+        this->final_vals[loc.thread].reserve(100);
+
     task_queue::task_t task;
     while (taskQueue->dequeue (task, loc)) {
         tasks++;
@@ -370,14 +686,14 @@ template<typename Impl, typename D, typename K, typename V, class Container>
 void MapReduce<Impl, D, K, V, Container>::run_merge ()
 {
     size_t total = 0;
-    for(size_t i = 0; i < num_threads; i++) {
+    for(size_t i = 0; i < thread_slots; i++) {
         total += this->final_vals[i].size();
     }
 
     std::vector<keyval>* final = new std::vector<keyval>[1];
     final[0].reserve(total);
 
-    for(size_t i = 0; i < num_threads; i++) {
+    for(size_t i = 0; i < thread_slots; i++) {
         final[0].insert(final[0].end(), this->final_vals[i].begin(), 
             this->final_vals[i].end());
     }
@@ -396,22 +712,23 @@ merge_worker (thread_loc const& loc, double& time, double& user_time, int& tasks
 template<typename Impl, typename D, typename K, typename V, class Container>
 void MapReduce<Impl, D, K, V, Container>::start_workers (void (*func)(void*, thread_loc const&), int num_threads, char const* stage)
 {
-    thread_arg_t* th_arg_array = new thread_arg_t[num_threads];
-    thread_arg_t** th_arg_ptrarray = new thread_arg_t*[num_threads];
+    // Spare arguments let threads that are added during the phase join it.
+    int num_args = std::max(num_threads, (int)thread_slots);
+    thread_arg_t* th_arg_array = new thread_arg_t[num_args];
+    thread_arg_t** th_arg_ptrarray = new thread_arg_t*[num_args];
     
-    thread_arg_t args = { this, 0, 0, 0 };
-    for (int thread = 0; thread < num_threads; ++thread) 
+    thread_arg_t args = { this, 0, 0, 0, 0, 0 };
+    for (int thread = 0; thread < num_args; ++thread) 
     {
         th_arg_array[thread] = args;
         th_arg_ptrarray[thread] = &(th_arg_array[thread]);        
     }
     
-    CHECK_ERROR (threadPool->set(func, (void **)th_arg_ptrarray, num_threads));
-    // Start worker threads
-    CHECK_ERROR (threadPool->begin());                
-    dprintf("Status: All %d threads have been created\n", num_threads);    
-    // Barrier, wait for all threads to finish.
-    CHECK_ERROR (threadPool->wait());            
+    // Run the phase on the pool's threads and wait for all of them to 
+    // finish.
+    num_threads = threadPool->run(func, (void **)th_arg_ptrarray, 
+        num_threads, num_args);
+    dprintf("Status: %d threads took part\n", num_threads);
 
 #ifdef TIMING
     double user_time = 0, work_time = 0, max_user_time = 0, 
@@ -434,8 +751,40 @@ void MapReduce<Impl, D, K, V, Container>::start_workers (void (*func)(void*, thr
     if(max_work_time > 0)
         fprintf (stderr, "%s avg thread time: %.3f    (%.3f, %.3f)\n", 
             stage, work_time / num_threads, min_work_time, max_work_time);
+
+    uint64_t steal_attempts, steals;
+    taskQueue->get_steal_stats(steal_attempts, steals);
+    fprintf (stderr, "%s steals: %lu of %lu attempts\n", 
+        stage, steals, steal_attempts);
+    taskQueue->reset_steal_stats();
 #endif
 
+    lock::stats ls;
+    for (int q = 0; q < taskQueue->num_sub_queues(); ++q)
+    {
+        if (!taskQueue->get_lock_stats(q, ls))
+            break;
+        fprintf (stderr, "%s queue %d %s lock: %lu acquisitions, "
+            "%lu contended, wait %.3f ms, hold %.3f ms\n", stage, q, 
+            lock::type_name(this->lock_type), ls.acquisitions, ls.contended,
+            ls.wait_ns / 1e6, ls.hold_ns / 1e6);
+    }
+    taskQueue->reset_lock_stats();
+
+    if (this->count_node_loads)
+    {
+        uint64_t loads = 0, remote = 0;
+        for (int thread = 0; thread < num_threads; ++thread) {
+            loads += th_arg_array[thread].loads;
+            remote += th_arg_array[thread].remote_loads;
+        }
+        if (loads > 0)
+            fprintf (stderr, "%s memory loads: %lu, remote %lu (%.1f%%)\n",
+                stage, loads, remote, 100.0 * remote / loads);
+        else
+            fprintf (stderr, "%s memory loads: not counted\n", stage);
+    }
+
     delete [] th_arg_ptrarray;
     delete [] th_arg_array;
     
@@ -466,7 +815,15 @@ protected:
     {
         // how many lists to merge in a single task.
         static const int merge_factor = 2;    
-        int merge_queues = this->num_threads;
+
+        // Only the threads that ran reduce tasks have values, move their 
+        // lists to the front.
+        int merge_queues = 0;
+        for(uint64_t i = 0; i < this->thread_slots; i++) {
+            if(this->final_vals[i].size() > 0)
+                this->final_vals[merge_queues++].swap(this->final_vals[i]);
+        }
+        merge_queues = std::max(merge_queues, 1);
     
         // First sort each queue in place
         for(int i = 0; i < merge_queues; i++)
@@ -475,7 +832,8 @@ protected:
                 { i, 0, (uint64_t)&this->final_vals[i], 0 };
             this->taskQueue->enqueue_seq(task, merge_queues);
         }
-        start_workers(&this->merge_callback, this->num_threads, "merge");
+        start_workers(&this->merge_callback, 
+            std::min((uint64_t)merge_queues, this->num_threads), "merge");
 
         // Then merge
         std::vector<keyval>* merge_vals;
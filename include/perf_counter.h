@@ -0,0 +1,72 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef PERF_COUNTER_H_
+#define PERF_COUNTER_H_
+
+#include <stdint.h>
+
+/* Hardware counters of the calling thread for the read accesses to one
+   of the CPU's caches, and for how many of them missed. On Linux they 
+   come from perf_event_open(2); where the kernel or the CPU lacks the 
+   events, or the counters may not be opened, valid() is false and read()
+   reports nothing. The counters count from construction until 
+   destruction. */
+class cache_counter
+{
+public:
+    enum cache_type {
+        NODE,           // loads that reach memory, missing: remote ones
+        DTLB,           // data TLB lookups for loads
+    };
+
+    cache_counter(cache_type cache, bool enable = true);
+    ~cache_counter();
+
+    bool valid() const { return access_fd >= 0; }
+
+    bool read(uint64_t& accesses, uint64_t& misses) const;
+
+private:
+    int access_fd;
+    int miss_fd;
+
+    cache_counter(cache_counter const&);
+    cache_counter& operator=(cache_counter const&);
+};
+
+/* Memory loads of the calling thread and how many of them were served 
+   by another NUMA node's memory. */
+class node_counter : public cache_counter
+{
+public:
+    node_counter(bool enable = true) : cache_counter(NODE, enable) {}
+};
+
+#endif /* PERF_COUNTER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,73 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef PREFETCH_READER_H_
+#define PREFETCH_READER_H_
+
+#include <pthread.h>
+#include <vector>
+
+#include "stddefines.h"
+
+/* Reads a file into memory on threads of its own, so that the input is
+   processed while the rest of it is still coming in. The file is read in
+   blocks of MR_READ_BLOCK bytes in order, several blocks at once, and 
+   wait() lets the consumer block until the part it needs is in. */
+class prefetch_reader
+{
+public:
+    // Start reading SIZE bytes of FD into BUF on THREADS threads. FD and
+    // BUF must stay valid until the reader is destroyed.
+    prefetch_reader(int fd, char* buf, uint64_t size, int threads);
+    // Waits for the reading threads.
+    ~prefetch_reader();
+
+    char const* data() const { return buf; }
+    uint64_t size() const { return length; }
+
+    // Block until the first END bytes are read, returns how many are.
+    uint64_t wait(uint64_t end);
+
+private:
+    int                     fd;
+    char*                   buf;
+    uint64_t                length;
+    uint64_t                num_blocks;
+    uint64_t                next_block;     // the next one to read
+    uint64_t                ready;          // bytes read from the start
+    std::vector<bool>       done;           // blocks read
+    std::vector<pthread_t>  threads;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+
+    static void* reader_main(void* arg);
+    void read_block(uint64_t block);
+};
+
+#endif /* PREFETCH_READER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
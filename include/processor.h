@@ -45,13 +45,25 @@
 #warning "Unknown system. Threads will not be allocated to processors."
 #endif
 
-/* Query the number of CPUs online. */
+#include <stdlib.h>
+#include <algorithm>
+
+#include "topology.h"
+
+/* Query the number of CPUs we may use: those online, or on Linux those 
+   in the process's affinity mask, limited by its cgroup CPU quota. */
 inline int proc_get_num_cpus (void)
 {
     int num_cpus;
     char *num_proc_str;
 
     num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#ifdef _LINUX_
+    if (!proc_allowed_cpus().empty())
+        num_cpus = proc_allowed_cpus().size();
+    if (cgroup_cpu_limit() > 0)
+        num_cpus = std::min(num_cpus, cgroup_cpu_limit());
+#endif
 
     /* Check if the user specified a different number of processors. */
     if ((num_proc_str = getenv("MAPRED_NPROCESSORS")))
@@ -73,13 +85,17 @@ static cpu_set_t* proc_get_full_set(void)
     static int          inited = 0;
 
     if (inited == 0) {
-        int i;
-        int n_cpus;
+        // All the CPUs the process was allowed to run on to begin with.
+        std::vector<int> const& cpus = proc_allowed_cpus();
 
         CPU_ZERO (&full_cs);
-        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-        for (i = 0; i < n_cpus; i++) {
-            CPU_SET(i, &full_cs);
+        for (size_t i = 0; i < cpus.size(); i++) {
+            CPU_SET(cpus[i], &full_cs);
+        }
+        if (cpus.empty()) {
+            int n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+            for (int i = 0; i < n_cpus; i++)
+                CPU_SET(i, &full_cs);
         }
 
         inited = 1;
@@ -119,12 +135,17 @@ inline int proc_unbind_thread ()
 #endif
 }
 
+/* The CPU the calling thread is running on. */
 inline int proc_get_cpuid (void)
 {
 #ifdef _LINUX_
     int i, ret;
     cpu_set_t cpu_set;
-    
+
+    ret = sched_getcpu ();
+    if (ret >= 0) return ret;
+
+    // No sched_getcpu, settle for the first CPU we may run on.
     ret = sched_getaffinity (0, sizeof (cpu_set), &cpu_set);
     if (ret < 0) return -1;
 
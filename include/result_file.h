@@ -0,0 +1,276 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef RESULT_FILE_H_
+#define RESULT_FILE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+
+#include "stddefines.h"
+#include "thread_pool.h"
+#include "str_key.h"
+
+/* Binary results that can be mapped and searched without parsing: the
+   keys sorted and concatenated in one blob, their offsets into it, and a
+   fixed-size value per key. A file has a header, COUNT + 1 offsets, COUNT
+   values padded to 8 bytes, and the key blob. Keys are stored as their 
+   traits see them, e.g. in upper case, so that lookups compare bytes. 
+   Integers are in host byte order. */
+#define RESULT_MAGIC "PHXRES01"
+
+struct result_header
+{
+    char        magic[8];
+    uint64_t    count;
+    uint64_t    value_size;
+    uint64_t    blob_size;
+};
+
+// Reads a result file through a read-only mapping.
+class result_file
+{
+public:
+    result_file() : map(NULL), map_size(0), owned(false), count(0) {}
+    ~result_file() { close(); }
+
+    // Returns false if PATH cannot be mapped or is no result file.
+    bool open(char const* path);
+    // Use the result file at DATA, e.g. a part of a bigger mapped file.
+    bool open(char const* data, uint64_t size);
+    void close();
+
+    uint64_t size() const { return count; }
+    uint64_t value_size() const { return header->value_size; }
+
+    // Key I, not terminated.
+    char const* key(uint64_t i, uint64_t& len) const {
+        len = offsets[i + 1] - offsets[i];
+        return blob + offsets[i];
+    }
+    void const* value(uint64_t i) const { 
+        return values + i * header->value_size; 
+    }
+
+    // The first key not less than KEY, or size().
+    uint64_t lower_bound(char const* key, uint64_t len) const;
+    // KEY's index, or size() if it is not there.
+    uint64_t find(char const* key, uint64_t len) const;
+
+private:
+    char const*             map;
+    uint64_t                map_size;
+    bool                    owned;          // mapped by open(path)
+    uint64_t                count;
+    result_header const*    header;
+    uint64_t const*         offsets;
+    char const*             values;
+    char const*             blob;
+
+    int compare(uint64_t i, char const* key, uint64_t len) const;
+};
+
+/* Writes MapReduce results to a result file on the threads of a pool:
+   the keys are sorted in slices that are then merged pairwise, and every
+   thread fills in its slice of the file through a shared mapping. KV is
+   a keyval with a str_key key and a plain value, which is copied as it 
+   is. The results themselves are not reordered. */
+template<class KV>
+class result_writer
+{
+public:
+    result_writer(thread_pool* pool, int threads) : 
+        pool(pool), threads(std::max(1, std::min(threads, 
+            pool->max_threads()))) {}
+
+    // Returns false on errors, see errno.
+    bool write(char const* path, std::vector<KV> const& result);
+    // Write it to FD at AT, a multiple of the page size, and return its 
+    // size in SIZE. The file is cut off after it.
+    bool write(int fd, uint64_t at, std::vector<KV> const& result, 
+        uint64_t& size);
+
+private:
+    enum step_t { SORT, MERGE, SIZE, FILL };
+
+    struct slice_t {
+        result_writer*  w;
+        uint64_t        begin, middle, end;
+        uint64_t        blob_begin;     // where its keys go
+    };
+
+    thread_pool*            pool;
+    int                     threads;
+    step_t                  step;
+    std::vector<KV const*>  order;
+    char*                   file;
+    result_header*          header;
+    uint64_t*               offsets;
+    char*                   values;
+    char*                   blob;
+
+    static bool less(KV const* a, KV const* b) { 
+        return a->key.compare(b->key) < 0; 
+    }
+
+    void run(step_t s, std::vector<slice_t>& slices) {
+        this->step = s;
+        std::vector<void*> args(slices.size());
+        for (size_t i = 0; i < slices.size(); ++i)
+            args[i] = &slices[i];
+        if (!args.empty())
+            this->pool->run(&worker, &args[0], args.size());
+    }
+
+    static void worker(void* arg, thread_loc const&) {
+        slice_t& s = *(slice_t*)arg;
+        s.w->work(s);
+    }
+
+    void work(slice_t& s);
+};
+
+template<class KV>
+void result_writer<KV>::work(slice_t& s)
+{
+    typename std::vector<KV const*>::iterator o = this->order.begin();
+    switch (this->step) {
+    case SORT:
+        std::sort(o + s.begin, o + s.end, less);
+        break;
+    case MERGE:
+        std::inplace_merge(o + s.begin, o + s.middle, o + s.end, less);
+        break;
+    case SIZE:
+        s.blob_begin = 0;
+        for (uint64_t i = s.begin; i < s.end; ++i)
+            s.blob_begin += this->order[i]->key.len;
+        break;
+    case FILL: {
+        // Keys are copied as their traits see them, e.g. upper-cased.
+        uint64_t pos = s.blob_begin;
+        for (uint64_t i = s.begin; i < s.end; ++i) {
+            KV const& kv = *this->order[i];
+            this->offsets[i] = pos;
+            for (uint64_t c = 0; c < kv.key.len; ++c)
+                this->blob[pos + c] = kv.key.normalize(kv.key.data[c]);
+            pos += kv.key.len;
+            memcpy(this->values + i * sizeof(kv.val), &kv.val, 
+                sizeof(kv.val));
+        }
+        break;
+    }
+    }
+}
+
+template<class KV>
+bool result_writer<KV>::write(char const* path, std::vector<KV> const& result)
+{
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+    uint64_t size;
+    bool ok = write(fd, 0, result, size);
+    ::close(fd);
+    return ok;
+}
+
+template<class KV>
+bool result_writer<KV>::write(int fd, uint64_t at, 
+    std::vector<KV> const& result, uint64_t& size)
+{
+    uint64_t count = result.size();
+    this->order.resize(count);
+    for (uint64_t i = 0; i < count; ++i)
+        this->order[i] = &result[i];
+
+    // Sort slices, then merge neighbours until one is left.
+    uint64_t n = std::min((uint64_t)this->threads, std::max(count, 1UL));
+    std::vector<slice_t> slices(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        slice_t s = { this, count * i / n, 0, count * (i + 1) / n, 0 };
+        slices[i] = s;
+    }
+    run(SORT, slices);
+    for (uint64_t width = 1; width < n; width *= 2) {
+        std::vector<slice_t> merges;
+        for (uint64_t i = 0; i + width < n; i += 2 * width) {
+            slice_t s = { this, slices[i].begin, slices[i + width].begin,
+                slices[std::min(i + 2 * width, n) - 1].end, 0 };
+            merges.push_back(s);
+        }
+        run(MERGE, merges);
+    }
+
+    // Where every slice's keys go.
+    run(SIZE, slices);
+    uint64_t blob_size = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t size = slices[i].blob_begin;
+        slices[i].blob_begin = blob_size;
+        blob_size += size;
+    }
+
+    uint64_t value_size = sizeof(((KV*)0)->val);
+    uint64_t offsets_at = sizeof(result_header);
+    uint64_t values_at = offsets_at + (count + 1) * sizeof(uint64_t);
+    uint64_t blob_at = values_at + (count * value_size + 7) / 8 * 8;
+    size = blob_at + blob_size;
+
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, at + size) == 0)
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, at);
+    if (p == MAP_FAILED)
+        return false;
+
+    this->file = (char*)p;
+    this->header = (result_header*)this->file;
+    this->offsets = (uint64_t*)(this->file + offsets_at);
+    this->values = this->file + values_at;
+    this->blob = this->file + blob_at;
+
+    memcpy(this->header->magic, RESULT_MAGIC, sizeof(this->header->magic));
+    this->header->count = count;
+    this->header->value_size = value_size;
+    this->header->blob_size = blob_size;
+    this->offsets[count] = blob_size;
+
+    run(FILL, slices);
+
+    bool ok = munmap(this->file, size) == 0;
+    this->order.clear();
+    return ok;
+}
+
+#endif /* RESULT_FILE_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
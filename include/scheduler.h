@@ -27,8 +27,11 @@
 #ifndef SCHEDULER_H_
 #define SCHEDULER_H_
 
+#include <algorithm>
+
 #include "locality.h"
 #include "processor.h"
+#include "topology.h"
 
 
 #ifdef _SOLARIS_
@@ -42,16 +45,47 @@ protected:
     int     num_cpus;
     int     num_chips_per_sys;
     int        offset;
+    std::vector<int> cpus;      // the CPUs threads may go to, in order
 public:
     sched_policy(int offset = 0) : offset(offset) 
     {
         num_cpus = proc_get_num_cpus();
         num_chips_per_sys = loc_get_num_lgrps ();
+        order_cpus(std::vector<int>());
     }
 
     virtual ~sched_policy() {}
 
     virtual int thr_to_cpu(int thr) const = 0;
+
+protected:
+    /* Fill threads in ORDER, leaving out the CPUs the process may not 
+       use. An empty ORDER, e.g. for lack of topology information, means
+       the CPUs in numbering order. */
+    void order_cpus(std::vector<int> const& order)
+    {
+        std::vector<int> allowed = proc_allowed_cpus();
+        if (allowed.empty())
+            for (int i = 0; i < num_cpus; ++i)
+                allowed.push_back(i);
+
+        cpus.clear();
+        for (size_t i = 0; i < order.size(); ++i)
+            if (std::binary_search(allowed.begin(), allowed.end(), order[i]))
+                cpus.push_back(order[i]);
+        if (cpus.empty())
+            cpus = allowed;
+
+        // Use no more CPUs than we may keep busy, e.g. under a cgroup
+        // quota; further threads wrap around.
+        if (num_cpus > 0 && (size_t)num_cpus < cpus.size())
+            cpus.resize(num_cpus);
+    }
+
+    int ordered_cpu(int thr) const
+    {
+        return cpus[(thr+offset) % cpus.size()];
+    }
 };
 
 class sched_policy_strand_fill : public sched_policy
@@ -60,14 +94,17 @@ public:
     sched_policy_strand_fill(int offset = 0) : sched_policy(offset) {}
     int thr_to_cpu(int thr) const
     {
-        return (thr+offset) % num_cpus;
+        return ordered_cpu(thr);
     }
 };
 
 class sched_policy_core_fill : public sched_policy
 {
 public:
-    sched_policy_core_fill(int offset = 0) : sched_policy(offset) {}
+    sched_policy_core_fill(int offset = 0) : sched_policy(offset) 
+    {
+        order_cpus(cpu_topology::get().core_order());
+    }
     int thr_to_cpu(int thr) const
     {
 #ifdef NUM_CORES_PER_CHIP
@@ -79,7 +116,7 @@ public:
         strand %= NUM_STRANDS_PER_CORE;
         return (core * NUM_STRANDS_PER_CORE + strand);
 #else
-        return (thr+offset) % num_cpus;
+        return ordered_cpu(thr);
 #endif
     }
 };
@@ -87,7 +124,10 @@ public:
 class sched_policy_chip_fill : public sched_policy
 {
 public:
-    sched_policy_chip_fill(int offset = 0) : sched_policy(offset) {}
+    sched_policy_chip_fill(int offset = 0) : sched_policy(offset) 
+    {
+        order_cpus(cpu_topology::get().chip_order());
+    }
     int thr_to_cpu(int thr) const
     {
 #ifdef NUM_CORES_PER_CHIP
@@ -103,7 +143,7 @@ public:
                 core * (NUM_STRANDS_PER_CORE) +
                 strand);
 #else
-        return (thr+offset) % num_cpus;
+        return ordered_cpu(thr);
 #endif
     }
 };
@@ -36,7 +36,19 @@
 
 // Tunables
 #define L2_CACHE_LINE_SIZE          64
-#define MR_LOCK_PTMUTEX
+#if !defined(MR_LOCK_PTMUTEX) && !defined(MR_LOCK_MCS) && \
+    !defined(MR_LOCK_TICKET) && !defined(MR_LOCK_TTAS)
+#define MR_LOCK_PTMUTEX             // default lock type, see MR_LOCK
+#endif
+//#define MR_QUEUE_CHASE_LEV        // lock-free work-stealing task queues
+#define MR_SPIN_COUNT               4000  // spins before a phase wait blocks
+#define MR_ELASTIC_SHRINK           0.20  // run queue wait ratio to shrink at
+#define MR_ELASTIC_GROW             0.05  // ... and to grow back at
+#define MR_HUGE_PAGE_SIZE           (2<<20) // smallest huge page allocation
+#define MR_READ_BLOCK               (4<<20) // prefetching reader block size
+#define MR_STREAM_AHEAD             8     // stream reader blocks read ahead
+#define MR_STREAM_BUFFERS           16    // ... and in memory at most
+#define MR_TOKEN_BLOCKS             64    // tokenizer blocks classified at once
 //#define TIMING
 #define dprintf(...)     //fprintf(stderr, __VA_ARGS__)     // Debug printf
 
@@ -47,7 +59,8 @@ struct thread_loc
     int cpu;
     int lgrp;
     mutable unsigned int seed;      // thread-local random number seed
-    char pad[L2_CACHE_LINE_SIZE-4*sizeof(int)];
+    volatile int retire;            // set when the pool retires the thread
+    char pad[L2_CACHE_LINE_SIZE-5*sizeof(int)];
 };
 
 /* Wrapper to check for errors */
@@ -0,0 +1,233 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef STR_KEY_H_
+#define STR_KEY_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+#include <tr1/functional>
+#include <tr1/unordered_set>
+
+#include "stddefines.h"
+
+// Characters compare as they are.
+struct str_key_traits
+{
+    static char normalize(char c) { return c; }
+
+    static int compare(char const* a, char const* b, size_t n) 
+    {
+        return memcmp(a, b, n);
+    }
+};
+
+// Characters compare as if they were upper case. Only ASCII letters have
+// a case, as in the C locale, which saves hashing a call to toupper.
+struct str_key_nocase_traits
+{
+    static char normalize(char c) 
+    { 
+        return c - ((unsigned char)(c - 'a') < 26) * ('a' - 'A'); 
+    }
+
+    static int compare(char const* a, char const* b, size_t n) 
+    {
+        // Most occurrences of a word are spelled the same way.
+        if (memcmp(a, b, n) == 0)
+            return 0;
+        for (size_t i = 0; i < n; i++) {
+            int d = (unsigned char)normalize(a[i]) - 
+                (unsigned char)normalize(b[i]);
+            if (d != 0)
+                return d;
+        }
+        return 0;
+    }
+};
+
+/* A string key that points into the input instead of copying or 
+   terminating it: a pointer and a length, with the hash computed once 
+   when the key is made. The input can stay read-only and be shared by 
+   concurrent jobs, and keys that hash differently never compare their
+   characters. TRAITS decide how characters compare and hash, see above.
+   std::tr1::hash is specialized to return the cached hash, so the 
+   containers and MapReduceSort take these keys as they are. */
+template<class Traits = str_key_traits>
+struct str_key
+{
+    char const* data;
+    uint64_t len;
+    uint64_t hash;
+
+    str_key() : data(NULL), len(0), hash(0) {}
+
+    str_key(char const* data, uint64_t len) : data(data), len(len)
+    {
+        // FNV-1a hash for 64 bits
+        hash = 14695981039346656037ULL;
+        for (uint64_t i = 0; i < len; i++)
+            hash = (hash ^ (uint64_t)(unsigned char)Traits::normalize(data[i]))
+                * 1099511628211ULL;
+    }
+
+    // strcmp order, i.e. a prefix comes first.
+    int compare(str_key const& other) const 
+    {
+        int d = Traits::compare(data, other.data, std::min(len, other.len));
+        if (d != 0)
+            return d;
+        return (len > other.len) - (len < other.len);
+    }
+
+    bool operator<(str_key const& other) const 
+    {
+        return compare(other) < 0;
+    }
+
+    bool operator==(str_key const& other) const 
+    {
+        return hash == other.hash && len == other.len && 
+            Traits::compare(data, other.data, len) == 0;
+    }
+
+    // a character as the traits see it.
+    static char normalize(char c) { return Traits::normalize(c); }
+
+    // the key as its traits see it, e.g. in upper case.
+    std::string str() const 
+    {
+        std::string s(data, len);
+        for (size_t i = 0; i < s.size(); i++)
+            s[i] = Traits::normalize(s[i]);
+        return s;
+    }
+};
+
+namespace std { namespace tr1 {
+template<class Traits>
+struct hash< str_key<Traits> >
+{
+    typedef str_key<Traits> argument_type;
+    typedef size_t result_type;
+
+    size_t operator()(str_key<Traits> const& key) const 
+    { 
+        return key.hash; 
+    }
+};
+} }
+
+/* One copy of every distinct key made from input that goes away, e.g. 
+   the pieces of a stream once they are mapped, for the containers to 
+   point into instead. The copies live as long as the pool, so it grows
+   with the vocabulary rather than the input. Keys are spread over 
+   stripes by hash, each with a lock of its own, so that concurrent map
+   tasks rarely wait for each other. */
+template<class Traits = str_key_traits>
+class str_key_pool
+{
+    typedef str_key<Traits> key;
+    enum { STRIPES = 64, CHUNK = 64 << 10 };
+
+    struct stripe {
+        pthread_mutex_t mutex;
+        std::tr1::unordered_set<key, std::tr1::hash<key> > keys;
+        std::vector<char*> chunks;
+        char* next;             // free room in the last chunk
+        uint64_t left;
+    };
+    stripe stripes[STRIPES];
+
+    str_key_pool(str_key_pool const&);
+    str_key_pool& operator=(str_key_pool const&);
+
+public:
+    str_key_pool()
+    {
+        for (int i = 0; i < STRIPES; i++) {
+            pthread_mutex_init(&stripes[i].mutex, NULL);
+            stripes[i].next = NULL;
+            stripes[i].left = 0;
+        }
+    }
+
+    ~str_key_pool()
+    {
+        for (int i = 0; i < STRIPES; i++) {
+            for (size_t j = 0; j < stripes[i].chunks.size(); j++)
+                free(stripes[i].chunks[j]);
+            pthread_mutex_destroy(&stripes[i].mutex);
+        }
+    }
+
+    // K, pointing into the pool. Thread safe.
+    key intern(key const& k)
+    {
+        // The containers index by the low bits of the hash, use the high.
+        stripe& s = stripes[(k.hash >> 58) % STRIPES];
+        pthread_mutex_lock(&s.mutex);
+        typename std::tr1::unordered_set<key, std::tr1::hash<key> >::
+            const_iterator i = s.keys.find(k);
+        if (i == s.keys.end()) {
+            char* copy;
+            if (k.len > CHUNK / 4) {
+                copy = (char*)malloc(k.len);
+                CHECK_ERROR(copy == NULL);
+                s.chunks.push_back(copy);
+            } else {
+                if (k.len > s.left) {
+                    s.next = (char*)malloc(CHUNK);
+                    CHECK_ERROR(s.next == NULL);
+                    s.left = CHUNK;
+                    s.chunks.push_back(s.next);
+                }
+                copy = s.next;
+                s.next += k.len;
+                s.left -= k.len;
+            }
+            memcpy(copy, k.data, k.len);
+            key c = k;
+            c.data = copy;
+            i = s.keys.insert(c).first;
+        }
+        key c = *i;
+        pthread_mutex_unlock(&s.mutex);
+        return c;
+    }
+};
+
+#endif /* STR_KEY_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
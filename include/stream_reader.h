@@ -0,0 +1,105 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef STREAM_READER_H_
+#define STREAM_READER_H_
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "stddefines.h"
+
+/* Reads a pipe or other stream of unknown length, e.g. standard input, 
+   on a thread of its own and hands it out in parts that end at 
+   whitespace, like the splitters do with files. The thread reads at most
+   MR_STREAM_AHEAD blocks ahead of what has been handed out, into a ring
+   of MR_STREAM_BUFFERS blocks that the consumer gives back with release()
+   once it is done with a part, so memory stays at that many blocks 
+   however long the stream is. Keys must not point into a part after it
+   is released, see str_key_pool. */
+class stream_reader
+{
+public:
+    // Read FD in blocks of BLOCK bytes.
+    stream_reader(int fd, uint64_t block);
+    // Stops reading, the stream need not be at its end.
+    ~stream_reader();
+
+    // The next part of the stream, about a block long and ending before 
+    // whitespace or at the end of the stream. AVAIL is LEN plus the bytes
+    // after it that are in memory too, i.e. that may be looked at. 
+    // Returns false at the end of the stream. Not thread safe.
+    bool next(char const*& data, uint64_t& len, uint64_t& avail);
+
+    // Give back the part at DATA, as returned by next(). Thread safe.
+    void release(char const* data);
+
+    // Bytes handed out so far.
+    uint64_t offset() const { return handed_out; }
+
+private:
+    struct block_t {
+        char*       buf;
+        uint64_t    len;
+    };
+
+    // The memory of handed out parts: a ring buffer, or a buffer of its
+    // own for a part longer than a block. Held by the consumer and by
+    // the tail while it lies in it.
+    struct buffer_t {
+        char*       mem;
+        bool        ring;
+        int         refs;
+    };
+
+    int                     fd;
+    uint64_t                block;
+    pthread_t               thread;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+    std::deque<block_t>     full;           // read, not yet handed out
+    std::vector<char*>      free_bufs;      // of the ring, not in use
+    std::vector<char*>      buffers;        // the ring, freed at the end
+    std::map<char const*, buffer_t*> parts; // handed out, not released
+    bool                    eof;
+    bool                    stop;
+
+    char const*             tail;           // read, not yet handed out
+    uint64_t                tail_len;
+    buffer_t*               tail_buf;       // ... and where it lies
+    uint64_t                handed_out;
+
+    static void* reader_main(void* arg);
+    bool take(block_t& b);
+    void unref(buffer_t* b);
+};
+
+#endif /* STREAM_READER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -29,75 +29,181 @@
 
 #include "stddefines.h"
 
-#ifdef MR_LOCK_PTMUTEX
-
+#include <string.h>
 #include <pthread.h>
+#include <algorithm>
+
+#include "atomic.h"
 
+// Locks
+
+/* The lock implementation is chosen at runtime with lock::create(). All
+   of them share the profiling code in this base class, which counts 
+   acquisitions, acquisitions that found the lock taken and the time 
+   spent waiting for and holding the lock. The counters are only updated
+   by the holder, so they need no synchronization of their own. THREAD 
+   is the caller's thread index and is only used by the MCS lock. */
 class lock
+{
+public:
+    enum lock_type { MUTEX, MCS, TICKET, TTAS };
+
+    struct stats {
+        uint64_t    acquisitions;
+        uint64_t    contended;      // acquisitions that had to wait
+        uint64_t    wait_ns;
+        uint64_t    hold_ns;
+    };
+
+    static lock* create(int threads, lock_type type, bool profile = false);
+
+    // The type selected at compile time, MR_LOCK_PTMUTEX by default.
+    static lock_type default_type()
+    {
+    #if defined(MR_LOCK_MCS)
+        return MCS;
+    #elif defined(MR_LOCK_TICKET)
+        return TICKET;
+    #elif defined(MR_LOCK_TTAS)
+        return TTAS;
+    #else
+        return MUTEX;
+    #endif
+    }
+
+    static char const* type_name(lock_type type)
+    {
+        static char const* names[] = { "mutex", "mcs", "ticket", "ttas" };
+        return names[type];
+    }
+
+    // Parse one of the names above. Returns false if NAME is unknown.
+    static bool parse_type(char const* name, lock_type& type)
+    {
+        for (int i = MUTEX; i <= TTAS; i++) {
+            if (strcmp(name, type_name((lock_type)i)) == 0) {
+                type = (lock_type)i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    virtual ~lock() {}
+
+    void acquire(int thread) {
+        if (!profile) {
+            do_acquire(thread);
+            return;
+        }
+
+        uint64_t begin = now();
+        bool contended = !do_try_acquire(thread);
+        if (contended)
+            do_acquire(thread);
+        held_since = now();
+
+        st.acquisitions++;
+        st.contended += contended;
+        st.wait_ns += held_since - begin;
+    }
+
+    void release(int thread) {
+        if (profile)
+            st.hold_ns += now() - held_since;
+        do_release(thread);
+    }
+
+    void get_stats(stats& s) const { s = st; }
+    void reset_stats() { memset(&st, 0, sizeof(st)); }
+
+protected:
+    lock(bool profile) : profile(profile), held_since(0) { reset_stats(); }
+
+    virtual void do_acquire(int thread) = 0;
+    virtual bool do_try_acquire(int thread) = 0;
+    virtual void do_release(int thread) = 0;
+
+private:
+    bool        profile;
+    uint64_t    held_since;
+    stats       st;
+
+    static uint64_t now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+};
+
+class mutex_lock : public lock
 {
     pthread_mutex_t m;
 public:
-    lock(int threads) {
+    mutex_lock(int threads, bool profile) : lock(profile) {
         pthread_mutex_init(&m, NULL);
     }
 
-    ~lock() {
+    ~mutex_lock() {
         pthread_mutex_destroy(&m);
     }
 
-    void acquire(int thread) {
+protected:
+    void do_acquire(int thread) {
         pthread_mutex_lock(&m);
     }
 
-    void release(int thread) {
+    bool do_try_acquire(int thread) {
+        return pthread_mutex_trylock(&m) == 0;
+    }
+
+    void do_release(int thread) {
         pthread_mutex_unlock(&m);
     }
 };
 
-#elif defined(MR_LOCK_MCS)
-
-#include <atomic.h>
-
-class lock
+class mcs_lock : public lock
 {
-    struct mcs_lock;
+    struct mcs_head;
 
     struct mcs_lock_priv {
-        mcs_lock  *mcs_head;
+        mcs_head  *head;
         mcs_lock_priv    *next;
         uintptr_t        locked;
         char pad[L2_CACHE_LINE_SIZE-3*sizeof(uintptr_t)];
     };
 
-    struct mcs_lock {
-        mcs_lock_priv    *head;
+    struct mcs_head {
+        mcs_lock_priv    *tail;
     };
 
-    mcs_lock l;
+    mcs_head l;
     mcs_lock_priv* privs;
 
 public:
-    lock(int threads) {
-        l.head = NULL;
+    mcs_lock(int threads, bool profile) : lock(profile) {
+        l.tail = NULL;
         privs = new mcs_lock_priv[threads];
         for(int i = 0; i < threads; i++) {
-            privs[i].mcs_head = &l;
+            privs[i].head = &l;
             privs[i].next = NULL;
             privs[i].locked = 0;
         }
     }
 
-    ~lock() {
+    ~mcs_lock() {
         delete [] privs;
     }
 
-    void acquire(int thread) {
+protected:
+    void do_acquire(int thread) {
         mcs_lock_priv* priv = &privs[thread];
-        mcs_lock* mcs = priv->mcs_head;
+        mcs_head* mcs = priv->head;
         assert(priv->locked == 0);
 
         set_and_flush(priv->next, NULL);
-        mcs_lock_priv* prev = (mcs_lock_priv*)(atomic_xchg((uintptr_t)priv, (uintptr_t*)(&mcs->head)));
+        mcs_lock_priv* prev = (mcs_lock_priv*)(atomic_xchg((uintptr_t)priv, (uintptr_t*)(&mcs->tail)));
         if(prev != NULL) {
             // someone else has lock
             // NOTE: this ordering is important-- if locked after next assignment,
@@ -109,12 +215,20 @@ public:
         }
     }
 
-    void release(int thread) {
+    bool do_try_acquire(int thread) {
         mcs_lock_priv* priv = &privs[thread];
-        mcs_lock* mcs = priv->mcs_head;
+
+        set_and_flush(priv->next, NULL);
+        return cmp_and_swp((uintptr_t)priv, (uintptr_t*)(&priv->head->tail), 
+            (uintptr_t)NULL);
+    }
+
+    void do_release(int thread) {
+        mcs_lock_priv* priv = &privs[thread];
+        mcs_head* mcs = priv->head;
 
         if(priv->next == NULL) {
-            if (cmp_and_swp( (uintptr_t)NULL, (uintptr_t*)(&mcs->head), 
+            if (cmp_and_swp( (uintptr_t)NULL, (uintptr_t*)(&mcs->tail), 
                 (uintptr_t)priv)) {
                 // we were the only one on the lock, now it's empty
                 return;
@@ -129,9 +243,85 @@ public:
         set_and_flush(priv->next->locked, 0);
     }
 };
-#else
-#warning "No lock type selected."
-#endif
+
+// FIFO spin lock. Tickets are taken with a compare-and-swap since that is
+// the widest atomic every supported architecture has.
+class ticket_lock : public lock
+{
+    volatile uintptr_t next;
+    char pad[L2_CACHE_LINE_SIZE-sizeof(uintptr_t)];
+    volatile uintptr_t serving;
+
+public:
+    ticket_lock(int threads, bool profile) : lock(profile), 
+        next(0), serving(0) {}
+
+protected:
+    void do_acquire(int thread) {
+        uintptr_t ticket;
+        do {
+            ticket = next;
+        } while (!cmp_and_swp(ticket + 1, (uintptr_t*)&next, ticket));
+
+        while (serving != ticket)
+            cpu_relax();
+    }
+
+    bool do_try_acquire(int thread) {
+        uintptr_t ticket = next;
+        return serving == ticket && 
+            cmp_and_swp(ticket + 1, (uintptr_t*)&next, ticket);
+    }
+
+    void do_release(int thread) {
+        asm("" ::: "memory");
+        serving = serving + 1;
+    }
+};
+
+// Test-and-test-and-set spin lock with exponential backoff after every 
+// lost race for the lock.
+class ttas_lock : public lock
+{
+    enum { MIN_BACKOFF = 16, MAX_BACKOFF = 16384 };
+
+    volatile uintptr_t held;
+
+public:
+    ttas_lock(int threads, bool profile) : lock(profile), held(0) {}
+
+protected:
+    void do_acquire(int thread) {
+        int backoff = MIN_BACKOFF;
+        while (true) {
+            while (held)
+                cpu_relax();
+            if (test_and_set((uintptr_t*)&held))
+                return;
+            spin_wait(backoff);
+            backoff = std::min(backoff * 2, (int)MAX_BACKOFF);
+        }
+    }
+
+    bool do_try_acquire(int thread) {
+        return !held && test_and_set((uintptr_t*)&held);
+    }
+
+    void do_release(int thread) {
+        asm("" ::: "memory");
+        held = 0;
+    }
+};
+
+inline lock* lock::create(int threads, lock_type type, bool profile)
+{
+    switch (type) {
+        case MCS:       return new mcs_lock(threads, profile);
+        case TICKET:    return new ticket_lock(threads, profile);
+        case TTAS:      return new ttas_lock(threads, profile);
+        default:        return new mutex_lock(threads, profile);
+    }
+}
 
 // Semaphores
 
@@ -179,6 +369,73 @@ public:
     }
 };
 
+// Spin-then-block events
+
+#ifdef _LINUX_
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <sched.h>
+#endif
+
+// A generation counter that threads can wait on. A waiter spins for a 
+// while before it sleeps in the kernel (a futex on Linux, sched_yield 
+// elsewhere), so an event that follows shortly after the previous one is 
+// picked up without a system call. The signaller only enters the kernel 
+// if somebody went to sleep.
+class spin_event
+{
+private:
+    volatile unsigned int gen;
+    volatile unsigned int sleepers;
+public:
+    spin_event() : gen(0), sleepers(0) {}
+
+    unsigned int generation() const
+    {
+        return gen;
+    }
+
+    // Advance the generation and wake all waiters.
+    void signal()
+    {
+        fetch_and_inc((unsigned int*)&gen);
+        if (sleepers > 0)
+        {
+        #ifdef _LINUX_
+            syscall(SYS_futex, &gen, FUTEX_WAKE_PRIVATE, INT_MAX, 
+                NULL, NULL, 0);
+        #endif
+        }
+    }
+
+    // Wait until the generation moves past OLD, spinning SPINS times 
+    // before blocking.
+    void wait(unsigned int old, int spins)
+    {
+        for (int i = 0; i < spins; i++)
+        {
+            if (gen != old)
+                return;
+            cpu_relax();
+        }
+
+        fetch_and_inc((unsigned int*)&sleepers);
+        while (gen == old)
+        {
+        #ifdef _LINUX_
+            syscall(SYS_futex, &gen, FUTEX_WAIT_PRIVATE, old, 
+                NULL, NULL, 0);
+        #else
+            sched_yield();
+        #endif
+        }
+        fetch_and_dec((unsigned int*)&sleepers);
+    }
+};
+
 #endif /* SYNCH_H_ */
 
 // vim: ts=8 sw=4 sts=4 smarttab smartindent
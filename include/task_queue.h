@@ -30,8 +30,9 @@
 #include <deque>
 
 #include "stddefines.h"
+#include "synch.h"
 
-class lock;
+template<typename T> class ws_deque;
 
 class task_queue
 {
@@ -44,20 +45,64 @@ public:
         uint64_t        pad;
     };
 
-    task_queue(int sub_queues, int num_threads);
+    // LOCK_TYPE selects the sub-queue locks, PROFILE_LOCKS turns on their
+    // contention counters. Both are ignored by the lock-free variant.
+    task_queue(int sub_queues, int num_threads, 
+        lock::lock_type lock_type = lock::default_type(), 
+        bool profile_locks = false);
     ~task_queue();
 
     void enqueue(task_t const& task, thread_loc const& loc, 
         int total_tasks=0, int lgrp=-1);
     void enqueue_seq(task_t const& task, int total_tasks=0, int lgrp=-1);
+    // Queue TASK on sub-queue QUEUE, i.e. for thread QUEUE, without 
+    // synchronization.
+    void enqueue_seq_to(task_t const& task, int queue);
     int dequeue(task_t& task, thread_loc const& loc);
 
+    // Sub-queue QUEUE is owned by a thread of locality group LGRP. Tasks 
+    // queued for a group are spread over its queues. Dequeuing keeps 
+    // the groups up to date; this tells them before the first dequeue.
+    void set_lgrp(int queue, int lgrp);
+
+    // Stealing statistics summed over all threads. An attempt is a visit
+    // to another queue, a success is a visit that took at least one task.
+    void get_steal_stats(uint64_t& attempts, uint64_t& successes) const;
+    void reset_steal_stats();
+
+    // Contention counters of sub-queue QUEUE's lock. Returns false if 
+    // the sub-queues have no locks or profiling is off.
+    int num_sub_queues() const { return num_queues; }
+    bool get_lock_stats(int queue, lock::stats& s) const;
+    void reset_lock_stats();
+
 private:
 
+    struct steal_stats {
+        uint64_t    attempts;
+        uint64_t    successes;
+        char pad[L2_CACHE_LINE_SIZE-2*sizeof(uint64_t)];
+    };
+
     int             num_queues;
     int             num_threads;
+    int             num_victims;    // number of queues that can be robbed
+    int*            lgrps;          // locality group of each victim's owner
+    steal_stats*    stats;          // per thread
+#ifdef MR_QUEUE_CHASE_LEV
+    // One lock-free deque per thread; sub-queue i is thread i's deque.
+    ws_deque<task_t>** deques;
+#else
     std::deque<task_t>* queues;
     lock**          locks;
+    bool            profile_locks;
+#endif
+
+    int own_index(thread_loc const& loc) const;
+    int queue_for(task_t const& task, int total_tasks, int lgrp, 
+        unsigned int* seed) const;
+    int pop(int index, task_t& task, thread_loc const& loc);
+    int steal_half(int victim, int index, task_t& task, thread_loc const& loc);
 };
 
 #endif /* TASK_Q_ */
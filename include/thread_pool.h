@@ -24,42 +24,127 @@
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */ 
 
+
 #ifndef TPOOL_H_
 #define TPOOL_H_
 
+#include <vector>
+
 #include "stddefines.h"
 #include "synch.h"
 
 typedef void (*thread_func)(void *, thread_loc const& loc);
 class sched_policy;
 
+/* A pool of worker threads that run phases: set() picks the function and
+   per-worker arguments, begin() starts them and wait() blocks until they 
+   are all done. run() does all three and may be called by several 
+   threads at once, e.g. by concurrent MapReduce jobs. Their phases then
+   share the pool: a new phase gets at most its fair share of the idle 
+   threads, and a thread that finishes its part of a phase joins the 
+   running phase with the fewest threads that still has spare arguments.
+   shared() is the process-wide pool that MapReduce jobs use by default.
+
+   The pool is elastic. It can hold up to max_threads() threads and 
+   resize() adds or retires threads at any time, also while a phase runs.
+   A thread added during a phase joins it if set() supplied a spare 
+   argument for it. A thread retired while it runs a phase finishes its
+   part of it like the others, stealing included, and only stops after
+   that, so queued tasks are never left behind. With set_elastic() 
+   the pool also shrinks by itself when its threads have to wait for a 
+   CPU and grows back when that pressure goes away. */
 class thread_pool
 {
 public:
-    thread_pool(int num_threads, sched_policy const* policy = NULL);
+    thread_pool(int num_threads, sched_policy const* policy = NULL, 
+        int max_threads = 0);
     ~thread_pool();
 
-    int set(thread_func thread_func, void** args, int num_workers);
+    // The process-wide pool, created on first use with MR_NUMTHREADS or
+    // else one thread per CPU, placed by sched_policy_strand_fill. It is
+    // never destroyed.
+    static thread_pool* shared();
+
+    // NUM_ARGS >= NUM_WORKERS arguments may be given; the spare ones are 
+    // handed to threads that join while the phase is running.
+    int set(thread_func thread_func, void** args, int num_workers, 
+        int num_args = 0);
     int begin();
     int wait();
 
+    // set(), begin() and wait() in one go, for a phase of its own. ARGS 
+    // must stay valid until it returns. Returns the number of arguments 
+    // used, like participants().
+    int run(thread_func thread_func, void** args, int num_workers, 
+        int num_args = 0);
+
+    int resize(int num_threads);
+    void set_elastic(bool elastic);
+
+    int size() const { return num_threads; }
+    int max_threads() const { return max_num_threads; }
+    // number of arguments used by the last phase started with begin(), 
+    // including joiners.
+    int participants() const { return legacy.next_arg; }
+    // The locality group of thread THREAD, -1 until it has started.
+    int lgrp_of(int thread) const 
+    { 
+        return __atomic_load_n(&thread_args[thread % max_num_threads].loc.lgrp,
+            __ATOMIC_RELAXED);
+    }
+
 private:
+    enum thread_state { DEAD, ALIVE };
+
+    struct phase_t {
+        thread_func     func;
+        void**          args;
+        int             num_workers;
+        int             num_args;
+        int             next_arg;       // arguments handed out so far
+        int             outstanding;    // threads still running it
+        volatile int    finished;
+        std::vector<bool> ran;          // slots that took part
+    };
+
     struct thread_arg_t {
         thread_pool*    pool;
         thread_loc      loc;
-        semaphore       sem_run;
+        phase_t* volatile job;      // phase this thread takes part in
+        void*           arg;        // its argument for that phase
+        thread_state    state;
+        bool            retiring;   // retire once out of its phase
+        long            tid;
+        uint64_t        sched_run;  // last schedstat sample
+        uint64_t        sched_wait;
     };
 
-    int             num_threads;
-    int             num_workers;
+    int             num_threads;        // live threads
+    int             target_threads;     // size requested by the user
+    int             max_num_threads;
     int             die;
-    thread_func     thread_function;
-    semaphore       sem_all_workers_done;
-    unsigned int    num_workers_done;
+    int             spins;
+    bool            elastic;
+    phase_t         legacy;             // the phase of set/begin/wait
+    std::vector<phase_t*> running;      // phases that have not finished
+    spin_event      run_event;          // a thread got a phase to run
+    spin_event      done_event;         // a phase finished
+    int             num_live;           // threads not yet exited
+    pthread_mutex_t mutex;
+    pthread_cond_t  all_exited;
+    pthread_attr_t  attr;
     void            **args;
     pthread_t       *threads;
     thread_arg_t    *thread_args;
 
+    int resize_locked(int num_threads);
+    void adapt();
+    void begin_phase(phase_t* phase);
+    void wait_phase(phase_t* phase);
+    void assign(thread_arg_t* thread_arg, phase_t* phase);
+    bool join_phase(thread_arg_t* thread_arg);
+    void leave_phase(thread_arg_t* thread_arg);
+    bool exit_thread(thread_arg_t* thread_arg);
 
     static void* loop (void*);
 };
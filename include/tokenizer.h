@@ -0,0 +1,172 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef TOKENIZER_H_
+#define TOKENIZER_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+#include "stddefines.h"
+
+/* Splits text into the words the applications count: a letter followed 
+   by letters and apostrophes, in ASCII. Rather than testing every byte,
+   the text is classified 64 bytes at a time into bit masks of letters, 
+   apostrophes and newlines, with SSE2 or AVX2 where the processor has 
+   them, and the words are found in the masks with shifts and bit scans.
+   The text is not changed; words are case-folded by str_key as they are
+   hashed. MR_SIMD=scalar, sse2 or avx2 picks the classifier, by default
+   the best the processor has. */
+
+enum tokenizer_isa { TOKENIZER_SCALAR, TOKENIZER_SSE2, TOKENIZER_AVX2 };
+
+// The masks of one block of 64 bytes, bit I for byte I.
+struct tokenizer_masks
+{
+    uint64_t    letters;
+    uint64_t    apostrophes;
+    uint64_t    newlines;
+};
+
+typedef void (*tokenizer_classify_t)(char const* data, uint64_t blocks, 
+    tokenizer_masks* out);
+
+// The classifier in use, chosen once when first asked. Thread safe.
+tokenizer_classify_t tokenizer_classify ();
+tokenizer_isa tokenizer_current ();
+// Use ISA from now on, or the best there is if the processor lacks it.
+// Returns the one used. Not while other threads tokenize.
+tokenizer_isa tokenizer_use (tokenizer_isa isa);
+char const* tokenizer_name (tokenizer_isa isa);
+
+/* Calls EMIT(word, len, line) for the words of DATA[0, LEN), in order. 
+   If LINES, line counts from 1 and a newline counts as inverted_index 
+   has always counted them: only after a byte that is not part of a 
+   word, and not at DATA[0]. The newline at DATA[LEN] is counted too if 
+   LEN < AVAIL, the bytes that can be read. Returns the lines plus one. 
+   Without LINES, line is 1 and AVAIL is not looked at. */
+template<bool LINES, class Emit>
+uint64_t tokenize (char const* data, uint64_t len, uint64_t avail, 
+    Emit& emit)
+{
+    tokenizer_classify_t classify = tokenizer_classify ();
+    tokenizer_masks masks[MR_TOKEN_BLOCKS];
+
+    // The bytes classified: for LINES, one more for the look-ahead.
+    uint64_t n = LINES && avail > len ? len + 1 : len;
+    uint64_t line = 1;                  // at the start of the block
+    uint64_t open = 0, open_line = 1;   // the word going on, if in_word
+    // Whether the last byte is in a word, a letter or apostrophe, or an
+    // apostrophe before a word.
+    uint64_t in_word = 0, in_run = 0, leading = 0;
+
+    for (uint64_t at = 0; at < n; ) {
+        // Whole blocks, then the rest padded with zeros.
+        uint64_t blocks = std::min((n - at) / 64, (uint64_t)MR_TOKEN_BLOCKS);
+        char tail[64];
+        if (blocks > 0) {
+            classify (data + at, blocks, masks);
+        } else {
+            memset (tail, 0, sizeof(tail));
+            memcpy (tail, data + at, n - at);
+            classify (tail, 1, masks);
+            blocks = 1;
+        }
+
+        for (uint64_t b = 0; b < blocks; b++, at += 64) {
+            uint64_t letters = masks[b].letters;
+            uint64_t apostrophes = masks[b].apostrophes;
+            if (at + 64 > len) {
+                // The look-ahead byte is not part of any word.
+                uint64_t keep = len > at ? ~0ULL >> (64 - (len - at)) : 0;
+                letters &= keep;
+                apostrophes &= keep;
+            }
+
+            // Runs of letters and apostrophes are words, except for the 
+            // apostrophes they start with.
+            uint64_t run = letters | apostrophes;
+            uint64_t lead = apostrophes & ~((run << 1) | in_run);
+            lead |= apostrophes & leading;
+            for (uint64_t more = lead; more != 0; ) {
+                more = (lead << 1) & apostrophes & ~lead;
+                lead |= more;
+            }
+            uint64_t word = run & ~lead;
+            uint64_t starts = word & ~((word << 1) | in_word);
+            uint64_t ends = word & ~(word >> 1) & ~(1ULL << 63);
+
+            // Newlines count after bytes that are not in a word, which 
+            // byte 0 of the text never is.
+            uint64_t counted = 0;
+            if (LINES)
+                counted = masks[b].newlines & 
+                    ((~word << 1) | (at > 0 && !in_word));
+
+            // A word from the last block ends first.
+            if (in_word) {
+                if (!(word & 1)) {
+                    emit (data + open, at - open, open_line);
+                } else if (ends != 0) {
+                    emit (data + open, at + __builtin_ctzll (ends) + 1 - open,
+                        open_line);
+                    ends &= ends - 1;
+                }
+            }
+            while (starts != 0) {
+                uint64_t s = __builtin_ctzll (starts);
+                starts &= starts - 1;
+                uint64_t l = line;
+                if (LINES)
+                    l += __builtin_popcountll (counted & ((1ULL << s) - 1));
+                if (ends == 0) {
+                    // It goes on in the next block.
+                    open = at + s;
+                    open_line = l;
+                    break;
+                }
+                uint64_t e = __builtin_ctzll (ends);
+                ends &= ends - 1;
+                emit (data + at + s, e + 1 - s, l);
+            }
+
+            if (LINES)
+                line += __builtin_popcountll (counted);
+            in_word = word >> 63;
+            in_run = run >> 63;
+            leading = lead >> 63;
+        }
+    }
+    if (in_word)
+        emit (data + open, len - open, open_line);
+    return line;
+}
+
+#endif /* TOKENIZER_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
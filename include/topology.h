@@ -0,0 +1,108 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include <vector>
+
+/* Parse a sysfs CPU or node list such as "0-3,8,10-11" into IDS. Returns
+   false if the string is malformed. */
+bool parse_cpu_list (char const* str, std::vector<int>& ids);
+
+/* Read a whole sysfs file below the sysfs root into BUF. The root is /sys
+   unless MR_SYSFS_ROOT names another directory, e.g. a fake tree for 
+   testing. Returns false if the file cannot be read. */
+bool sysfs_read (char const* path, char* buf, int size);
+
+/* The CPUs in the affinity mask the process started with, in ascending
+   order. Read once, on first use; empty where the mask is unknown. */
+std::vector<int> const& proc_allowed_cpus ();
+
+/* The CPU bandwidth the process's cgroup grants it, in CPUs rounded up, 
+   or 0 if it is not limited. Both cgroup v2 cpu.max and the v1 CFS 
+   quota are honoured, also those of parent groups. Read once. */
+int cgroup_cpu_limit ();
+
+/* The CPU topology of the machine: which package, core, last level 
+   cache and NUMA node every online CPU belongs to. On Linux it is read
+   from devices/system/cpu and devices/system/node below the sysfs root,
+   elsewhere it stays empty. */
+class cpu_topology
+{
+public:
+    struct cpu {
+        int     id;
+        int     package;
+        int     core;           // unique over the whole machine
+        int     llc;            // last level cache domain
+        int     smt;            // index among the core's hardware threads
+        int     node;           // NUMA node, -1 if unknown
+    };
+
+    cpu_topology();
+
+    // The topology of this machine, read once.
+    static cpu_topology const& get();
+
+    bool valid() const { return !cpus.empty(); }
+    int num_cpus() const { return cpus.size(); }
+
+    // Number of NUMA nodes, 0 if the node map could not be read.
+    int num_nodes() const { return nodes; }
+
+    // The NUMA node of CPU, or -1 if it is not known.
+    int node_of(int cpu) const 
+    { 
+        return (cpu >= 0 && cpu < (int)cpu_node.size()) ? cpu_node[cpu] : -1;
+    }
+
+    // CPUs ordered for filling one core after another: a thread per core,
+    // cores sharing a last level cache next to each other and packages 
+    // one after another, before the second hardware thread of any core.
+    std::vector<int> const& core_order() const { return by_core; }
+
+    // CPUs ordered for spreading over the packages first: consecutive 
+    // threads go to different packages, then to different cores, and 
+    // SMT siblings come last.
+    std::vector<int> const& chip_order() const { return by_chip; }
+
+private:
+    std::vector<cpu> cpus;
+    std::vector<int> by_core;
+    std::vector<int> by_chip;
+    std::vector<int> cpu_node;  // indexed by CPU id
+    int nodes;
+
+    void read();
+    void read_nodes();
+    void order();
+};
+
+#endif /* TOPOLOGY_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
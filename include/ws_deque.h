@@ -0,0 +1,179 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef WS_DEQUE_H_
+#define WS_DEQUE_H_
+
+#include <string.h>
+
+#include "stddefines.h"
+#include "atomic.h"
+
+/* Chase-Lev work-stealing deque.
+   The owning thread pushes and pops at the bottom without atomic 
+   read-modify-write operations; only the race for the last item needs a 
+   CAS. Any other thread steals from the top with a CAS. The circular 
+   buffer doubles when full. Replaced buffers are kept until the deque is 
+   destroyed since a concurrent thief may still be reading from them. */
+template<typename T>
+class ws_deque
+{
+public:
+    enum steal_result { EMPTY = 0, SUCCESS = 1, ABORT = 2 };
+
+    ws_deque(uint64_t initial_size = 64) : top(0), bottom(0)
+    {
+        uint64_t n = 1;
+        while(n < initial_size) n <<= 1;
+        buf = new_array(n, NULL);
+    }
+
+    ~ws_deque()
+    {
+        array* a = buf;
+        while(a != NULL) {
+            array* prev = a->prev;
+            delete [] a->items;
+            delete a;
+            a = prev;
+        }
+    }
+
+    /* Owner only. */
+    void push(T const& item)
+    {
+        uint64_t b = bottom;
+        uint64_t t = atomic_read((void*)&top);
+        array* a = buf;
+        if(b - t >= a->size)
+            a = grow(a, t, b);
+        a->items[b & (a->size-1)] = item;
+        asm("" ::: "memory");
+        bottom = b+1;
+    }
+
+    /* Owner only. Returns 0 if the deque is empty. */
+    int pop(T& item)
+    {
+        uint64_t b = bottom - 1;
+        array* a = buf;
+        bottom = b;
+        memory_barrier();
+        uint64_t t = top;
+
+        if((int64_t)(b - t) < 0) {
+            // empty, restore
+            bottom = b+1;
+            return 0;
+        }
+
+        item = a->items[b & (a->size-1)];
+        if(b != t)
+            return 1;
+
+        // Last item, race against thieves for it.
+        int won = cmp_and_swp(t+1, (uintptr_t*)&top, t);
+        bottom = b+1;
+        return won;
+    }
+
+    /* Any thread. ABORT means another thread won the race for the top 
+       item and the caller may retry. */
+    steal_result steal(T& item)
+    {
+        uint64_t t = atomic_read((void*)&top);
+        memory_barrier();
+        uint64_t b = atomic_read((void*)&bottom);
+
+        if((int64_t)(b - t) <= 0)
+            return EMPTY;
+
+        array* a = (array*)atomic_read((void*)&buf);
+        T tmp = a->items[t & (a->size-1)];
+        if(!cmp_and_swp(t+1, (uintptr_t*)&top, t))
+            return ABORT;
+        item = tmp;
+        return SUCCESS;
+    }
+
+    /* Sequential only, i.e. no concurrent owner or thieves. Queues ITEM 
+       at the top so that the owner pops items in the order they were 
+       added, the same as the locked FIFO queues. */
+    void push_seq(T const& item)
+    {
+        uint64_t t = top, b = bottom;
+        array* a = buf;
+        if(b - t >= a->size)
+            a = grow(a, t, b);
+        t--;
+        a->items[t & (a->size-1)] = item;
+        top = t;
+    }
+
+    /* Approximate when called concurrently. */
+    uint64_t size() const
+    {
+        int64_t n = (int64_t)(bottom - top);
+        return n > 0 ? n : 0;
+    }
+
+private:
+    struct array {
+        uint64_t    size;
+        T*          items;
+        array*      prev;
+    };
+
+    volatile uint64_t   top;
+    char                pad0[L2_CACHE_LINE_SIZE-sizeof(uint64_t)];
+    volatile uint64_t   bottom;
+    array* volatile     buf;
+    char                pad1[L2_CACHE_LINE_SIZE-sizeof(uint64_t)-sizeof(array*)];
+
+    static array* new_array(uint64_t size, array* prev)
+    {
+        array* a = new array;
+        a->size = size;
+        a->items = new T[size];
+        a->prev = prev;
+        return a;
+    }
+
+    array* grow(array* a, uint64_t t, uint64_t b)
+    {
+        array* n = new_array(a->size << 1, a);
+        for(uint64_t i = t; i != b; i++)
+            n->items[i & (n->size-1)] = a->items[i & (a->size-1)];
+        asm("" ::: "memory");
+        buf = n;
+        return n;
+    }
+};
+
+#endif /* WS_DEQUE_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,78 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#ifndef ZBLOCK_H_
+#define ZBLOCK_H_
+
+#include <stdint.h>
+#include <vector>
+
+/* Block-compressed text. The text is cut into blocks after whitespace 
+   and every block is compressed with zlib on its own, so that blocks can
+   be decompressed independently and in parallel. A file starts with a
+   header, followed by the index of its blocks and the compressed blocks.
+   Integers are in host byte order. */
+#define ZBLOCK_MAGIC "PHXZBLK1"
+
+/* Deflate shrinks text at most about 1032 times, a block whose text is
+   longer than that many times its compressed length is corrupt. */
+#define ZBLOCK_MAX_RATIO 1032
+
+struct zblock_header
+{
+    char        magic[8];
+    uint64_t    num_blocks;
+    uint64_t    raw_size;       // of the text
+};
+
+struct zblock_entry
+{
+    uint64_t    offset;         // of the compressed block in the file
+    uint64_t    raw_offset;     // ... and of its text
+    uint32_t    len;
+    uint32_t    raw_len;
+};
+
+// Read the index of FD. Returns 1 if it is block-compressed, 0 if it is
+// not and -1 if its index does not fit the file: blocks past its end, 
+// texts that do not follow each other or that no block could hold.
+int zblock_read_index (int fd, std::vector<zblock_entry>& index);
+
+// Decompress the block described by E from the file of SIZE bytes mapped
+// at FILE into OUT, which has room for E.raw_len bytes. Returns false if
+// it is corrupt.
+bool zblock_decompress (char const* file, uint64_t size, 
+    zblock_entry const& e, char* out);
+
+// Write SIZE bytes of DATA to FD block-compressed, in blocks of about 
+// BLOCK_SIZE bytes. Returns false on errors, see errno.
+bool zblock_write (int fd, char const* data, uint64_t size, 
+    uint64_t block_size, int level);
+
+#endif /* ZBLOCK_H_ */
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -30,52 +30,23 @@
 #include <string.h>
 #include <ctype.h>
 #include <algorithm>
+#include <string>
 
 #include "map_reduce.h"
+#include "str_key.h"
+#include "file_set.h"
+#include "prefetch_reader.h"
+#include "stream_reader.h"
+#include "index_file.h"
+#include "tokenizer.h"
 #define DEFAULT_DISP_NUM 50
+#define CHUNK_SIZE (1024*1024)
+#define DEFAULT_READERS 2
 
-// a passage from the text. The input data to the Map-Reduce
-struct wc_string {
-    char* data;
-    uint64_t len;
-};
-
-// a single null-terminated word
-struct wc_word {
-    char* data;
-    
-    // necessary functions to use this as a key
-    bool operator<(wc_word const& other) const {
-        return strcmp(data, other.data) < 0;
-    }
-    bool operator==(wc_word const& other) const {
-        return strcmp(data, other.data) == 0;
-    }
-};
-
-
-// a hash for the word
-struct wc_word_hash
-{
-    // FNV-1a hash for 64 bits
-    size_t operator()(wc_word const& key) const
-    {
-        char* h = key.data;
-        uint64_t v = 14695981039346656037ULL;
-        while (*h != 0)
-            v = (v ^ (size_t)(*(h++))) * 1099511628211ULL;
-        return v;
-    }
-};
-
-struct chunk_details{
-    uint64_t chunk_no;
-    uint64_t total_lines;
-    char* data;
-    bool operator<(chunk_details const& other) const {
-    return (chunk_no < other.chunk_no);
-    }
-};
+// a single word, pointing into the input. Words are neither terminated
+// nor upper-cased in place, they compare and hash as if upper case.
+typedef str_key<str_key_nocase_traits> wc_word;
+typedef std::tr1::hash<wc_word> wc_word_hash;
 
 struct find_word{
     wc_word word;
@@ -84,7 +55,7 @@ struct find_word{
 
 struct value{
     uint64_t line_no;
-    uint64_t chunk_no;
+    uint64_t chunk_no;      // the file_set piece
     std::vector <uint64_t> line;
     std::vector <uint64_t> cn;
     bool operator==(value const& other) const {
@@ -92,25 +63,27 @@ struct value{
     }
 };
 
-class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, value, hash_container<wc_word, value, buffer_combiner, wc_word_hash> >
+class WordsMR : public MapReduceSort<WordsMR, file_set::chunk, wc_word, value, hash_container<wc_word, value, buffer_combiner, wc_word_hash, 
+    huge_page_allocator> >
 {
-    char* data;
-    uint64_t data_size;
-    uint64_t chunk_size;
-    uint64_t splitter_pos;
+    file_set& files;
     std::vector <find_word> match;
-    std::vector <chunk_details> chunk_status;
-    std::vector <chunk_details> current_chunk;
-    uint64_t number_of_chunks;
+    // lines started in each piece of the input, plus one. The splitter
+    // may add pieces while map tasks run, see setStreaming.
+    mutable std::vector <uint64_t> total_lines;
+    mutable pthread_mutex_t lines_lock;
 
 public:
-    explicit WordsMR(char* _data, uint64_t length, uint64_t _chunk_size) :
-        data(_data), data_size(length), chunk_size(_chunk_size), 
-            splitter_pos(0) { number_of_chunks = 1;}
+    // The input is a set of files, or a single file already in memory.
+    // Each map task gets a run of small files or a piece of a large one.
+    explicit WordsMR(file_set& _files) : files(_files) {
+        pthread_mutex_init(&lines_lock, NULL);
+    }
+    ~WordsMR() { pthread_mutex_destroy(&lines_lock); }
 
-    void* locate(data_type* str, uint64_t len) const
+    void* locate(data_type* c, uint64_t len) const
     {
-        return str->data;
+        return (void*)files.address(*c);
     }
     void addWord(char word_[]){
         
@@ -121,109 +94,62 @@ public:
         for(uint64_t i = 0; i < len ; i++)wordd[i] = toupper(wordd[i]);
 
         find_word t;
-        t.word = wc_word{wordd};
+        t.word = wc_word(wordd, len);
         match.push_back(t);
     }
     
-    void map(data_type const& s, map_container& out) const
+    void map(data_type const& c, map_container& out) const
     {
+        for (uint64_t p = c.first; p < c.first + c.count; p++)
+            map_piece(p, out);
+    }
 
-        chunk_details temp;
-        uint64_t index_;
-
-        for(uint64_t i=0; i < current_chunk.size(); i++){
-            if(current_chunk.at(i).data == s.data){
-                temp = current_chunk.at(i);
-                index_ = i;
-            }
-        }
-
-        for (uint64_t i = 0; i < s.len; i++)
-        {
-            s.data[i] = toupper(s.data[i]);
-        }
-
-        uint64_t count_lines = 1;
-        temp.total_lines = count_lines;
-
-        uint64_t i = 0;
-        while(i < s.len)
-        {   
-            while(i < s.len && (s.data[i] < 'A' || s.data[i] > 'Z')){
-                i++;
-                if(s.data[i] == '\n'){
-                    count_lines++;
-                    temp.total_lines = count_lines;   
-                }
-            
-            }
-
-            uint64_t start = i;
-            while(i < s.len && ((s.data[i] >= 'A' && s.data[i] <= 'Z') || s.data[i] == '\''))
-                i++;
-
-            if(i > start)
-            {
-                s.data[i] = 0;
-                wc_word word = { s.data+start };
-                
-                for(uint64_t k = 0; k < match.size(); k++){
-
-                    if(word == match.at(k).word){
-   
-                        value vl;
-                        vl.line_no = count_lines;
-                        vl.chunk_no = index_;
-                        emit_intermediate(out, match.at(k).word, vl);
-
-                    }
-                    
+    // Emits the words of a piece that are on the list.
+    struct match_emitter
+    {
+        WordsMR const* mr;
+        map_container& out;
+        uint64_t piece;
+
+        void operator()(char const* data, uint64_t len, uint64_t line) const {
+            wc_word word(data, len);
+            for(uint64_t k = 0; k < mr->match.size(); k++){
+                if(word == mr->match.at(k).word){
+                    value vl;
+                    vl.line_no = line;
+                    vl.chunk_no = piece;
+                    mr->emit_intermediate(out, mr->match.at(k).word, vl);
                 }
-
             }
         }
-        
-        chunk_status.push_back(temp);
+    };
 
+    void map_piece(uint64_t index_, map_container& out) const
+    {
+        // Lines are counted as they always were, see tokenize.
+        file_set::piece s = files.get(index_);
+        match_emitter emit = { this, out, index_ };
+        uint64_t count_lines = tokenize<true>(s.data, s.len, s.avail, emit);
+        files.release(index_);
+        
+        pthread_mutex_lock(&lines_lock);
+        total_lines[index_] = count_lines;
+        pthread_mutex_unlock(&lines_lock);
     }
 
     /** wordcount split()
-     *  Memory map the file and divide file on a word border i.e. a space.
+     *  Pack small files together and divide large ones on a word border
+     *  i.e. a space, see file_set::split.
      */
-    int split(wc_string& out)
+    int split(file_set::chunk& out)
     {
-        
-        /* End of data reached, return FALSE. */
-        if ((uint64_t)splitter_pos >= data_size)
-        {
+        if (!files.split(out))
             return 0;
-        }
-
-        //Keeps track of the file we processing
-        chunk_details temp;
-        temp.chunk_no = number_of_chunks;
-
-        /* Determine the nominal end point. */
-        uint64_t end = std::min(splitter_pos + chunk_size, data_size);
-
-        /* Move end point to next word break */
-        while(end < data_size && 
-            data[end] != ' ' && data[end] != '\t' &&
-            data[end] != '\r' && data[end] != '\n')
-            end++;
 
-        /* Set the start of the next data. */
-        out.data = data + splitter_pos;
-        out.len = end - splitter_pos;
-
-        temp.data = out.data;
-        
-        splitter_pos = end;
-
-        current_chunk.push_back(temp);
-        number_of_chunks++;
-
-        /* Return true since the out data is valid. */
+        //Keeps track of the lines in each piece
+        pthread_mutex_lock(&lines_lock);
+        total_lines.resize(files.num_pieces(), 1);
+        pthread_mutex_unlock(&lines_lock);
         return 1;
     }
 
@@ -261,23 +187,34 @@ public:
         
     }
 
+// Turn the line numbers within pieces into line numbers within files,
+// and leave the file of each line in cn.
 void fix_arrange(std::vector<WordsMR::keyval> &result){
-    std::sort(chunk_status.begin(),chunk_status.end());
+    // lines in the earlier pieces of the same file
+    std::vector<uint64_t> base(total_lines.size(), 0);
+    std::vector<uint32_t> file(total_lines.size(), 0);
+    for (size_t k = 0; k < total_lines.size(); k++){
+        file[k] = files.get(k).file;
+        if(k > 0 && file[k] == file[k-1])
+            base[k] = base[k-1] + total_lines[k-1] - 1;
+    }
     
     for (size_t i = 0; i < result.size(); i++)
     {
-        //add line numbers from other chunks
+        //add line numbers from other pieces
+        std::vector<std::pair<uint64_t, uint64_t> > lines;
         for (size_t j = 0; j < result[i].val.line.size(); j++){
-            int summer = 0;
-            for(int k = 0; k < result[i].val.cn.at(j); k++)  
-                summer+=chunk_status.at(k).total_lines-1;
-
-            result[i].val.line.at(j) += summer;
-            
+            uint64_t k = result[i].val.cn.at(j);
+            lines.push_back(std::make_pair(file[k], 
+                result[i].val.line.at(j) + base[k]));
         }
         //Arrange the line numbers in orderly manner
-        std::sort(result[i].val.line.begin(),result[i].val.line.end());
+        std::sort(lines.begin(), lines.end());
 
+        for (size_t j = 0; j < lines.size(); j++){
+            result[i].val.cn.at(j) = lines[j].first;
+            result[i].val.line.at(j) = lines[j].second;
+        }
     }
 }
 
@@ -286,13 +223,216 @@ void fix_arrange(std::vector<WordsMR::keyval> &result){
 
 
 
+// Builds the postings and hits of every word of the input for an index 
+// file, see index_file.h. Map tasks emit every word with its piece, its
+// number in the piece and its line, and the reduce tasks turn them into
+// encoded lists.
+class IndexMR : public MapReduce<IndexMR, file_set::chunk, wc_word, index_hit, hash_container<wc_word, index_hit, buffer_combiner, wc_word_hash, 
+    huge_page_allocator> >
+{
+    file_set& files;
+    // lines started in each piece of the input, plus one, and its words
+    mutable std::vector <uint64_t> total_lines;
+    mutable std::vector <uint64_t> total_words;
+    mutable pthread_mutex_t lines_lock;
+    // lines and words in the earlier pieces of the same file, and the file
+    std::vector <uint64_t> base;
+    std::vector <uint64_t> word_base;
+    std::vector <uint64_t> file;
+    // the encoded postings and hits of all words, and where each word's are
+    mutable std::vector <char> postings;
+    mutable std::vector <char> hits;
+    mutable std::vector <index_term> terms;
+    mutable pthread_mutex_t postings_lock;
+    // copies of the words of streams, whose pieces go away once mapped
+    mutable str_key_pool<str_key_nocase_traits> copies;
+
+    struct word_emitter
+    {
+        IndexMR const* mr;
+        map_container& out;
+        uint64_t piece;
+        uint64_t words;
+        bool copy;
+
+        void operator()(char const* data, uint64_t len, uint64_t line) {
+            index_hit hit = { index_posting(piece, words++), line };
+            wc_word word(data, len);
+            if (copy)
+                word = mr->copies.intern(word);
+            mr->emit_intermediate(out, word, hit);
+        }
+    };
+
+public:
+    struct term_kv { wc_word key; index_term val; };
+
+    explicit IndexMR(file_set& _files) : files(_files) {
+        pthread_mutex_init(&lines_lock, NULL);
+        pthread_mutex_init(&postings_lock, NULL);
+    }
+    ~IndexMR() { 
+        pthread_mutex_destroy(&lines_lock); 
+        pthread_mutex_destroy(&postings_lock); 
+    }
+
+    void* locate(data_type* c, uint64_t len) const
+    {
+        return (void*)files.address(*c);
+    }
+
+    void map(data_type const& c, map_container& out) const
+    {
+        for (uint64_t p = c.first; p < c.first + c.count; p++) {
+            file_set::piece s = files.get(p);
+            word_emitter emit = { this, out, p, 0, files.streamed(s.file) };
+            uint64_t count_lines = tokenize<true>(s.data, s.len, s.avail, 
+                emit);
+            files.release(p);
+
+            pthread_mutex_lock(&lines_lock);
+            total_lines[p] = count_lines;
+            total_words[p] = emit.words;
+            pthread_mutex_unlock(&lines_lock);
+        }
+    }
+
+    int split(file_set::chunk& out)
+    {
+        if (!files.split(out))
+            return 0;
+
+        pthread_mutex_lock(&lines_lock);
+        total_lines.resize(files.num_pieces(), 1);
+        total_words.resize(files.num_pieces(), 0);
+        pthread_mutex_unlock(&lines_lock);
+        return 1;
+    }
+
+    // All lines are counted once the map tasks are done.
+    void run_reduce()
+    {
+        base.assign(total_lines.size(), 0);
+        word_base.assign(total_lines.size(), 0);
+        file.assign(total_lines.size(), 0);
+        for (size_t k = 0; k < total_lines.size(); k++){
+            file[k] = files.get(k).file;
+            if(k > 0 && file[k] == file[k-1]){
+                base[k] = base[k-1] + total_lines[k-1] - 1;
+                word_base[k] = word_base[k-1] + total_words[k-1];
+            }
+        }
+        MapReduce<IndexMR, file_set::chunk, wc_word, index_hit, 
+            container_type>::run_reduce();
+    }
+
+    // Outputs the word with the index of its term in pos.
+    void reduce(key_type const& key, reduce_iterator const& values, 
+        std::vector<keyval>& out) const 
+    {
+        std::vector<index_hit> hit_list;
+        std::vector<uint64_t> list;
+        index_hit v;
+        while (values.next(v))
+        {
+            uint64_t k = index_file_of(v.pos);
+            index_hit h = { index_posting(file[k], 
+                index_line_of(v.pos) + word_base[k]), v.line + base[k] };
+            hit_list.push_back(h);
+            list.push_back(index_posting(file[k], h.line));
+        }
+        std::sort(hit_list.begin(), hit_list.end());
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+
+        std::vector<char> encoded, encoded_hits;
+        index_encode(&list[0], list.size(), encoded);
+        index_encode(&hit_list[0], hit_list.size(), encoded_hits);
+
+        pthread_mutex_lock(&postings_lock);
+        index_term t = { postings.size(), list.size(), 
+            hits.size(), hit_list.size() };
+        postings.insert(postings.end(), encoded.begin(), encoded.end());
+        hits.insert(hits.end(), encoded_hits.begin(), encoded_hits.end());
+        index_hit term = { terms.size(), 0 };
+        keyval kv = { key, term };
+        terms.push_back(t);
+        pthread_mutex_unlock(&postings_lock);
+        out.push_back(kv);
+    }
+
+    uint64_t num_postings() const { return postings.size(); }
+    uint64_t num_hits() const { return hits.size(); }
+
+    /* Write the index of RESULT to PATH on this job's threads. Returns 
+     * less than zero on errors.
+     */
+    int write(char const* path, std::vector<keyval> const& result)
+    {
+        std::vector<std::string> names(files.num_files());
+        for (size_t i = 0; i < names.size(); i++)
+            names[i] = files.name(i);
+
+        std::vector<term_kv> dict(result.size());
+        for (size_t i = 0; i < result.size(); i++) {
+            dict[i].key = result[i].key;
+            dict[i].val = terms[result[i].val.pos];
+        }
+        return index_write(path, names, postings, hits, dict, pool(), 
+            this->num_threads) ? 0 : -1;
+    }
+};
+
+// Whether ARG is the number of results to display rather than an input.
+static bool is_disp_num(char const* arg)
+{
+    struct stat st;
+    return arg[strspn(arg, "0123456789")] == '\0' && stat(arg, &st) < 0;
+}
+
+// Index every word of FILES into an index file at PATH.
+static int build_index(file_set& files, bool streaming, char const* path)
+{
+    struct timespec begin, end;
+
+    printf("Inverted_index: Calling MapReduce Scheduler Index\n");
+    get_time (begin);
+    std::vector<IndexMR::keyval> result;
+    IndexMR mapReduce(files);
+    if (streaming)
+        mapReduce.setStreaming(true);
+    if (mapReduce.run(result) < 0)
+        return -1;
+    get_time (end);
+
+    #ifdef TIMING
+    print_time("library", begin, end);
+    #endif
+
+    get_time (begin);
+    if (mapReduce.write(path, result) < 0)
+        return -1;
+    get_time (end);
+
+    #ifdef TIMING
+    print_time("index", begin, end);
+    #endif
+
+    printf("Inverted_index: Indexed %lu words into %s (%lu bytes of postings, %lu of hits)\n",
+        (uint64_t)result.size(), path, mapReduce.num_postings(), 
+        mapReduce.num_hits());
+    return 0;
+}
+
 int main(int argc, char *argv[]) 
 {
-    int fd;
-    char * fdata;
+    int fd = -1;
+    char * fdata = NULL;
+    prefetch_reader * reader = NULL;
+    stream_reader * stream = NULL;
     unsigned int disp_num;
     struct stat finfo;
-    char * fname, * disp_num_str;
+    char * fname, * disp_num_str = NULL;
     struct timespec begin, end;
     FILE* check_list_f;
     check_list_f = fopen("./inverted_index/given_list.txt", "r");
@@ -302,27 +442,83 @@ int main(int argc, char *argv[])
     // Make sure a filename is specified
     if (argv[1] == NULL)
     {
-        printf("USAGE: %s <filename> [Top # of results to display]\n", argv[0]);
+        printf("USAGE: %s <file, directory or ->... [Top # of results to display]\n", argv[0]);
         exit(1);
     }
 
+    int inputs = argc - 1;
+    if (inputs > 1 && is_disp_num(argv[argc-1]))
+        disp_num_str = argv[inputs--];
     fname = argv[1];
-    disp_num_str = argv[2];
 
     printf("Inverted_index: Running...\n");
 
-    // Read in the file
-    CHECK_ERROR((fd = open(fname, O_RDONLY)) < 0);
-    // Get the file info (for file length)
-    CHECK_ERROR(fstat(fd, &finfo) < 0);
-
-    uint64_t r = 0;
-
-    fdata = (char *)malloc (finfo.st_size);
-    CHECK_ERROR (fdata == NULL);
-    while(r < (uint64_t)finfo.st_size)
-        r += pread (fd, fdata + r, finfo.st_size, r);
-    CHECK_ERROR (r != (uint64_t)finfo.st_size);
+    file_set files(CHUNK_SIZE);
+    bool mapped = atoi(GETENV("MR_MMAP")) != 0;
+    if (inputs > 1 || strcmp(fname, "-") == 0 || 
+        stat(fname, &finfo) < 0 || !S_ISREG(finfo.st_mode) ||
+        file_set::compressed(fname))
+    {
+        // A corpus of files, mapped as the map tasks get to them, and "-"
+        // for standard input, split as it is read. Compressed files are 
+        // decompressed by the map tasks.
+        for (int i = 1; i <= inputs; i++)
+        {
+            if (strcmp(argv[i], "-") == 0 && stream == NULL)
+            {
+                stream = new stream_reader(0, CHUNK_SIZE);
+                files.add("stdin", *stream);
+            }
+            else
+                CHECK_ERROR(!files.add(argv[i]));
+        }
+    }
+    else
+    {
+        // Read in the file
+        CHECK_ERROR((fd = open(fname, O_RDONLY)) < 0);
+        // Get the file info (for file length)
+        CHECK_ERROR(fstat(fd, &finfo) < 0);
+
+        // With MR_MMAP=1 the file is mapped read-only instead of copied. 
+        // The map tasks read it ahead as they go.
+        if (mapped)
+        {
+            CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size, 
+                PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
+            madvise(fdata, finfo.st_size, MADV_SEQUENTIAL);
+            madvise(fdata, std::min((uint64_t)finfo.st_size, 
+                (uint64_t)CHUNK_SIZE), MADV_WILLNEED);
+            files.add(fname, fdata, finfo.st_size, true);
+        }
+        else
+        {
+            fdata = (char *)huge_alloc (finfo.st_size);
+            CHECK_ERROR (fdata == NULL);
+            // Place the input on all nodes before reading it in.
+            loc_spread_mem (fdata, finfo.st_size);
+
+            // The copy is read in on MR_READERS threads while the map 
+            // tasks work on what is there. MR_PREFETCH=0 reads all of it
+            // up front.
+            char const* prefetch_str = getenv("MR_PREFETCH");
+            if (prefetch_str == NULL || atoi(prefetch_str) != 0)
+            {
+                char const* readers_str = getenv("MR_READERS");
+                reader = new prefetch_reader(fd, fdata, finfo.st_size, 
+                    readers_str ? atoi(readers_str) : DEFAULT_READERS);
+                files.add(fname, *reader);
+            }
+            else
+            {
+                uint64_t r = 0;
+                while(r < (uint64_t)finfo.st_size)
+                    r += pread (fd, fdata + r, finfo.st_size, r);
+                CHECK_ERROR (r != (uint64_t)finfo.st_size);
+                files.add(fname, fdata, finfo.st_size);
+            }
+        }
+    }
 
     //read stop words
     if (!check_list_f) {
@@ -340,62 +536,96 @@ int main(int argc, char *argv[])
     print_time("initialize", begin, end);
     #endif
 
-    printf("Inverted_index: Calling MapReduce Scheduler Wordcount\n");
-    get_time (begin);
-    std::vector<WordsMR::keyval> result;    
-    WordsMR mapReduce(fdata, finfo.st_size, 1024*1024);
-
-    //Words to find line numbers
-    char stop_word[20];
-     while (fscanf(check_list_f,"%15s",stop_word) != EOF )
-     {
-         char temp[1];
-        char *tt = temp;
-        for(int i = 0; i < 20; i++)
-            if(!isalpha(stop_word[i]))
-            {
-                tt[i] = 0;
-                break;
-            }
-            else tt[i] = stop_word[i];
+    // Map a stream as it is split. So too a file still being read in, 
+    // unless there are locality groups to queue its chunks by, which 
+    // takes splitting it all first.
+    bool streaming = stream != NULL || 
+        (reader != NULL && loc_get_num_lgrps() <= 1);
+
+    // With MR_INDEX=path every word is indexed instead, see index_file.h,
+    // for tools/query to look up.
+    char const* index_str = getenv("MR_INDEX");
+    if (index_str != NULL)
+    {
+        CHECK_ERROR(build_index(files, streaming, index_str) < 0);
+    }
+    else
+    {
+        printf("Inverted_index: Calling MapReduce Scheduler Wordcount\n");
+        get_time (begin);
+        std::vector<WordsMR::keyval> result;    
+        WordsMR mapReduce(files);
+        if (streaming)
+            mapReduce.setStreaming(true);
+
+        // Frequent words carry long line lists, optionally reduce them alone.
+        char const* hot_str = getenv("MR_HOTKEYS");
+        if (hot_str != NULL)
+            mapReduce.setHotKeys(atof(hot_str));
+
+        //Words to find line numbers
+        char stop_word[20];
+         while (fscanf(check_list_f,"%15s",stop_word) != EOF )
+         {
+             char temp[1];
+            char *tt = temp;
+            for(int i = 0; i < 20; i++)
+                if(!isalpha(stop_word[i]))
+                {
+                    tt[i] = 0;
+                    break;
+                }
+                else tt[i] = stop_word[i];
             
-         mapReduce.addWord(tt);
-     }
-    close(check_list_f);
-    CHECK_ERROR( mapReduce.run(result) < 0);
-    get_time (end);
+             mapReduce.addWord(tt);
+         }
+        close(check_list_f);
+        CHECK_ERROR( mapReduce.run(result) < 0);
+        get_time (end);
 
-    #ifdef TIMING
-    print_time("library", begin, end);
-    #endif
-    printf("Inverted_index: MapReduce Completed\n");
+        #ifdef TIMING
+        print_time("library", begin, end);
+        #endif
+        printf("Inverted_index: MapReduce Completed\n");
 
-    get_time (begin);
+        get_time (begin);
 
-    printf("\nInverted_index Results:\n");
+        printf("\nInverted_index Results:\n");
 
-    //mapReduce.display(disp_num);
-    mapReduce.fix_arrange(result);
+        //mapReduce.display(disp_num);
+        mapReduce.fix_arrange(result);
 
-    for (size_t i = 0; i < result.size(); i++)
-    {
-        printf("%15s - ", result[i].key.data);
+        for (size_t i = 0; i < result.size(); i++)
+        {
+            printf("%15s - ", result[i].key.str().c_str());
 
-        for (size_t j = 0; j < result[i].val.line.size(); j++){
-            if(j>=disp_num)break;
-            printf("%lu ", result[i].val.line.at(j));
+            for (size_t j = 0; j < result[i].val.line.size(); j++){
+                if(j>=disp_num)break;
+                // With several files, say which one the line is in.
+                if(files.num_files() > 1)
+                    printf("%s:", files.name(result[i].val.cn.at(j)));
+                printf("%lu ", result[i].val.line.at(j));
 
-        }
+            }
         
         
-        printf("\n\n");
+            printf("\n\n");
+        }
     }
 
     
 
-    free (fdata);
-
-    CHECK_ERROR(close(fd) < 0);
+    // A corpus is unmapped by the file set.
+    delete stream;
+    if (fd >= 0) {
+        if (mapped) {
+            CHECK_ERROR(munmap(fdata, finfo.st_size) < 0);
+        } else {
+            delete reader;
+            huge_free (fdata, finfo.st_size);
+        }
+        CHECK_ERROR(close(fd) < 0);
+    }
 
     get_time (end);
 
@@ -0,0 +1,371 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "../include/file_set.h"
+
+file_set::file_set(uint64_t chunk_size) : chunk_size(chunk_size), 
+    next_file(0), next_offset(0)
+{
+    CHECK_ERROR (pthread_mutex_init (&this->mutex, NULL));
+}
+
+file_set::~file_set()
+{
+    for (size_t i = 0; i < pieces.size(); ++i)
+        if (!files[pieces[i].file].blocks.empty())
+            free ((void*)pieces[i].data);
+    for (size_t i = 0; i < files.size(); ++i)
+        if (files[i].owned && files[i].data != NULL)
+            munmap ((void*)files[i].data, files[i].map_size);
+    pthread_mutex_destroy (&this->mutex);
+}
+
+bool file_set::add(char const* path)
+{
+    struct stat st;
+    if (stat (path, &st) < 0)
+        return false;
+
+    if (S_ISDIR (st.st_mode))
+        return add_dir (path);
+
+    file_t f = { path, (uint64_t)st.st_size, (uint64_t)st.st_size, NULL, 
+        true, true, NULL, NULL };
+
+    // The text of a compressed file is the sum of its blocks.
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    int compressed = zblock_read_index (fd, f.blocks);
+    close (fd);
+    if (compressed < 0) {
+        fprintf (stderr, "%s: corrupt block index\n", path);
+        return false;
+    }
+    if (compressed > 0)
+        f.size = f.blocks.empty() ? 0 : 
+            f.blocks.back().raw_offset + f.blocks.back().raw_len;
+
+    files.push_back(f);
+    return true;
+}
+
+bool file_set::compressed(char const* path)
+{
+    std::vector<zblock_entry> index;
+    int fd = open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    // A corrupt one too, add(PATH) reports it.
+    bool ret = zblock_read_index (fd, index) != 0;
+    close (fd);
+    return ret;
+}
+
+bool file_set::add_dir(std::string const& path)
+{
+    DIR* dir = opendir (path.c_str());
+    if (dir == NULL)
+        return false;
+
+    std::vector<std::string> names;
+    struct dirent* e;
+    while ((e = readdir (dir)) != NULL)
+        if (strcmp (e->d_name, ".") != 0 && strcmp (e->d_name, "..") != 0)
+            names.push_back(e->d_name);
+    closedir (dir);
+    std::sort(names.begin(), names.end());
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        std::string name = path + "/" + names[i];
+        struct stat st;
+        if (stat (name.c_str(), &st) < 0)
+            continue;
+        if (S_ISDIR (st.st_mode))
+            add_dir (name);
+        else if (S_ISREG (st.st_mode))
+            add (name.c_str());
+    }
+    return true;
+}
+
+void file_set::add(char const* name, char const* data, uint64_t size, 
+    bool mapped)
+{
+    file_t f = { name, size, size, data, false, mapped, NULL, NULL };
+    files.push_back(f);
+}
+
+void file_set::add(char const* name, prefetch_reader& reader)
+{
+    file_t f = { name, reader.size(), reader.size(), reader.data(), false, 
+        false, &reader, NULL };
+    files.push_back(f);
+}
+
+void file_set::add(char const* name, stream_reader& reader)
+{
+    file_t f = { name, 0, 0, NULL, false, false, NULL, &reader };
+    files.push_back(f);
+}
+
+uint64_t file_set::wait(uint32_t file, uint64_t end)
+{
+    file_t const& f = files[file];
+    return f.reader != NULL ? f.reader->wait(end) : f.size;
+}
+
+char const* file_set::load(uint32_t index)
+{
+    pthread_mutex_lock (&this->mutex);
+    file_t& f = files[index];
+    if (f.data == NULL && f.map_size > 0) {
+        int fd = open (f.name.c_str(), O_RDONLY);
+        void* p = MAP_FAILED;
+        if (fd >= 0) {
+            p = mmap (NULL, f.map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            close (fd);
+        }
+        if (p == MAP_FAILED) {
+            perror (f.name.c_str());
+            f.size = 0;
+        } else {
+            madvise (p, f.map_size, MADV_SEQUENTIAL);
+            f.data = (char const*)p;
+        }
+    }
+    char const* data = f.data;
+    pthread_mutex_unlock (&this->mutex);
+    return data;
+}
+
+bool file_set::split(chunk& out)
+{
+    // Skip empty files, and streams at their end.
+    while (next_file < files.size()) {
+        if (files[next_file].stream != NULL) {
+            if (split_stream (out))
+                return true;
+        } else if (!files[next_file].blocks.empty()) {
+            if (split_block (out))
+                return true;
+        } else if (next_offset < files[next_file].size) {
+            break;
+        }
+        next_file++;
+        next_offset = 0;
+    }
+    if (next_file >= files.size())
+        return false;
+
+    out.first = pieces.size();
+
+    if (next_offset == 0 && files[next_file].size <= chunk_size) {
+        // Pack whole small files, until the next one does not fit.
+        uint64_t total = 0;
+        while (next_file < files.size() && files[next_file].stream == NULL &&
+            files[next_file].blocks.empty() &&
+            total + files[next_file].size <= chunk_size) {
+            if (files[next_file].size > 0) {
+                piece_t p = { next_file, 0, files[next_file].size, NULL, 0, 0 };
+                wait (next_file, p.len);
+                push (p);
+                total += p.len;
+            }
+            next_file++;
+        }
+    } else {
+        // Cut a piece off a large file, at the next word break.
+        file_t const& f = files[next_file];
+        char const* data = load (next_file);
+        uint64_t end = std::min(next_offset + chunk_size, f.size);
+        uint64_t ready = wait (next_file, end + 1);
+        while (end < f.size && data != NULL &&
+            data[end] != ' ' && data[end] != '\t' &&
+            data[end] != '\r' && data[end] != '\n') {
+            end++;
+            if (end >= ready)
+                ready = wait (next_file, end + MR_READ_BLOCK);
+        }
+
+        piece_t p = { next_file, next_offset, end - next_offset, NULL, 0, 0 };
+        push (p);
+        next_offset = end;
+    }
+
+    out.count = pieces.size() - out.first;
+    return true;
+}
+
+bool file_set::split_stream(chunk& out)
+{
+    file_t& f = files[next_file];
+    piece_t p = { next_file, f.stream->offset(), 0, NULL, 0, 0 };
+    if (!f.stream->next (p.data, p.len, p.avail))
+        return false;
+
+    out.first = pieces.size();
+    out.count = 1;
+    push (p);
+    // Read by size() only once the splitter is done.
+    f.size = f.stream->offset();
+    return true;
+}
+
+bool file_set::split_block(chunk& out)
+{
+    // A block per map task, they are about CHUNK_SIZE or more anyway.
+    file_t const& f = files[next_file];
+    if (next_offset >= f.blocks.size())
+        return false;
+
+    zblock_entry const& e = f.blocks[next_offset];
+    piece_t p = { next_file, e.raw_offset, e.raw_len, NULL, e.raw_len, 
+        next_offset };
+    out.first = pieces.size();
+    out.count = 1;
+    push (p);
+    next_offset++;
+    return true;
+}
+
+char const* file_set::decompress(uint64_t index, piece_t& p)
+{
+    char const* file = load (p.file);
+    zblock_entry const& e = files[p.file].blocks[p.block];
+    char* data = (char*)malloc (std::max(e.raw_len, 1U));
+    CHECK_ERROR (data == NULL);
+    if (file == NULL || 
+        !zblock_decompress (file, files[p.file].map_size, e, data)) {
+        fprintf (stderr, "%s: block %lu is corrupt\n", 
+            files[p.file].name.c_str(), p.block);
+        memset (data, ' ', e.raw_len);
+    }
+
+    // Keep the block for keys that point into it, unless another thread
+    // was first.
+    pthread_mutex_lock (&this->mutex);
+    if (pieces[index].data == NULL)
+        pieces[index].data = data;
+    else
+        free (data);
+    p.data = pieces[index].data;
+    pthread_mutex_unlock (&this->mutex);
+    return p.data;
+}
+
+void file_set::push(piece_t const& p)
+{
+    // Map tasks may be looking up pieces meanwhile.
+    pthread_mutex_lock (&this->mutex);
+    pieces.push_back(p);
+    pthread_mutex_unlock (&this->mutex);
+}
+
+void file_set::read_ahead(piece_t const& p, piece_t const& next) const
+{
+    file_t const& f = files[next.file];
+    if (!f.mapped || f.data == NULL || next.file != p.file)
+        return;
+
+    // Of a compressed file, read ahead the next compressed block.
+    uint64_t offset = next.offset, len = next.len;
+    if (!f.blocks.empty()) {
+        offset = f.blocks[next.block].offset;
+        len = f.blocks[next.block].len;
+    }
+
+    uintptr_t page = sysconf (_SC_PAGESIZE);
+    uintptr_t begin = (uintptr_t)(f.data + offset) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(f.data + offset + len);
+    madvise ((void*)begin, end - begin, MADV_WILLNEED);
+}
+
+file_set::piece file_set::get(uint64_t index)
+{
+    pthread_mutex_lock (&this->mutex);
+    piece_t p = pieces[index];
+    bool last = index + 1 >= pieces.size();
+    piece_t next = last ? p : pieces[index + 1];
+    pthread_mutex_unlock (&this->mutex);
+
+    if (p.data == NULL && !files[p.file].blocks.empty()) {
+        decompress (index, p);
+        if (!last)
+            read_ahead (p, next);
+    }
+
+    if (p.data != NULL) {
+        piece out = { p.data, p.len, p.file, p.offset, p.avail };
+        return out;
+    }
+
+    char const* data = load (p.file);
+    if (!last)
+        read_ahead (p, next);
+
+    uint64_t avail = data != NULL ? files[p.file].size - p.offset : 0;
+    piece out = { data + p.offset, std::min(p.len, avail), 
+        p.file, p.offset, avail };
+    return out;
+}
+
+void file_set::release(uint64_t index)
+{
+    pthread_mutex_lock (&this->mutex);
+    piece_t const& p = pieces[index];
+    stream_reader* stream = files[p.file].stream;
+    char const* data = p.data;
+    pthread_mutex_unlock (&this->mutex);
+
+    if (stream != NULL)
+        stream->release (data);
+}
+
+char const* file_set::address(chunk const& c) const
+{
+    if (c.count == 0)
+        return NULL;
+    piece_t const& p = pieces[c.first];
+    if (p.data != NULL || !files[p.file].blocks.empty())
+        return p.data;
+    // Only the splitter and load() write the pointers, and load() only 
+    // runs once the map tasks do.
+    char const* data = files[p.file].data;
+    return data != NULL ? data + p.offset : NULL;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
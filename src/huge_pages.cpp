@@ -0,0 +1,102 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "../include/huge_pages.h"
+#include "../include/stddefines.h"
+
+static pthread_once_t enabled_once = PTHREAD_ONCE_INIT;
+static bool enabled = false;
+
+static void read_enabled ()
+{
+    enabled = atoi(GETENV("MR_HUGEPAGES")) != 0;
+}
+
+bool huge_pages_enabled ()
+{
+    pthread_once (&enabled_once, read_enabled);
+    return enabled;
+}
+
+static bool use_huge_pages (size_t size)
+{
+    return size >= MR_HUGE_PAGE_SIZE && huge_pages_enabled();
+}
+
+static size_t round_up (size_t size)
+{
+    return (size + MR_HUGE_PAGE_SIZE - 1) & ~(size_t)(MR_HUGE_PAGE_SIZE - 1);
+}
+
+void* huge_alloc (size_t size)
+{
+    if (!use_huge_pages (size))
+        return malloc (size);
+
+    size_t len = round_up (size);
+    void* p;
+
+#ifdef MAP_HUGETLB
+    p = mmap (NULL, len, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED)
+        return p;
+#endif
+
+    // No huge pages reserved. Map more than needed so that the range can
+    // be trimmed to huge page alignment, which THP needs to back it.
+    p = mmap (NULL, len + MR_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    uintptr_t begin = (uintptr_t)p;
+    uintptr_t aligned = round_up (begin);
+    if (aligned > begin)
+        munmap (p, aligned - begin);
+    munmap ((void*)(aligned + len), begin + MR_HUGE_PAGE_SIZE - aligned);
+
+#ifdef MADV_HUGEPAGE
+    madvise ((void*)aligned, len, MADV_HUGEPAGE);
+#endif
+    return (void*)aligned;
+}
+
+void huge_free (void* ptr, size_t size)
+{
+    if (!use_huge_pages (size))
+        free (ptr);
+    else if (ptr != NULL)
+        munmap (ptr, round_up (size));
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,228 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "../include/index_file.h"
+
+// Append D in bytes of 7 bits, the lowest first.
+static inline void put_varint (uint64_t d, std::vector<char>& out)
+{
+    while (d >= 0x80) {
+        out.push_back((char)(d | 0x80));
+        d >>= 7;
+    }
+    out.push_back((char)d);
+}
+
+static inline uint64_t get_varint (unsigned char const*& p, 
+    unsigned char const* end)
+{
+    uint64_t d = 0;
+    for (int shift = 0; p < end; shift += 7) {
+        d |= (uint64_t)(*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            break;
+    }
+    return d;
+}
+
+void index_encode (uint64_t const* postings, uint64_t count, 
+    std::vector<char>& out)
+{
+    uint64_t last = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        put_varint (postings[i] - last, out);
+        last = postings[i];
+    }
+}
+
+void index_encode (index_hit const* hits, uint64_t count, 
+    std::vector<char>& out)
+{
+    uint64_t last = 0, line = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        // Lines start over in every file.
+        if (index_file_of (hits[i].pos) != index_file_of (last))
+            line = 0;
+        put_varint (hits[i].pos - last, out);
+        put_varint (hits[i].line - line, out);
+        last = hits[i].pos;
+        line = hits[i].line;
+    }
+}
+
+// Whether SIZE bytes at AT lie within TOTAL, without overflowing.
+static inline bool fits (uint64_t at, uint64_t size, uint64_t total)
+{
+    return at <= total && size <= total - at;
+}
+
+// The number of entries a term may claim at OFFSET of a section of SIZE
+// bytes, each taking at least MIN bytes: a corrupt term must not make us
+// allocate more than the section could hold, or read outside it.
+static inline uint64_t fitting (uint64_t count, uint64_t offset, 
+    uint64_t size, uint64_t min)
+{
+    return offset > size ? 0 : std::min(count, (size - offset) / min);
+}
+
+bool index_file::open(char const* path)
+{
+    close ();
+
+    int fd = ::open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat (fd, &st) == 0 && st.st_size >= (off_t)sizeof(index_header))
+        p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close (fd);
+    if (p == MAP_FAILED)
+        return false;
+    this->map = (char const*)p;
+    this->map_size = st.st_size;
+
+    // Check that the sections fit before trusting them.
+    index_header const& h = *(index_header const*)this->map;
+    if (memcmp (h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0 ||
+        !fits (h.names_at, h.names_size, this->map_size) ||
+        !fits (h.postings_at, h.postings_size, this->map_size) ||
+        !fits (h.hits_at, h.hits_size, this->map_size) ||
+        !fits (h.terms_at, h.terms_size, this->map_size) ||
+        !this->terms.open (this->map + h.terms_at, h.terms_size) ||
+        this->terms.value_size() != sizeof(index_term)) {
+        close ();
+        return false;
+    }
+
+    char const* name = this->map + h.names_at;
+    char const* end = name + h.names_size;
+    while (name < end && this->names.size() < h.num_files) {
+        this->names.push_back(name);
+        name += strnlen (name, end - name) + 1;
+    }
+    if (this->names.size() != h.num_files) {
+        close ();
+        return false;
+    }
+
+    this->post = this->map + h.postings_at;
+    this->post_size = h.postings_size;
+    this->hit = this->map + h.hits_at;
+    this->hit_size = h.hits_size;
+    return true;
+}
+
+void index_file::close()
+{
+    this->terms.close ();
+    this->names.clear();
+    if (this->map != NULL)
+        munmap ((void*)this->map, this->map_size);
+    this->map = NULL;
+}
+
+void index_file::postings(uint64_t i, std::vector<uint64_t>& out) const
+{
+    index_term const& t = *(index_term const*)this->terms.value (i);
+    // A posting takes a byte at least.
+    uint64_t count = fitting (t.count, t.offset, this->post_size, 1);
+    out.resize(count);
+    if (count == 0)
+        return;
+
+    unsigned char const* p = (unsigned char const*)this->post + t.offset;
+    unsigned char const* end = (unsigned char const*)this->post + 
+        this->post_size;
+    uint64_t last = 0;
+    for (uint64_t n = 0; n < count; ++n) {
+        last += get_varint (p, end);
+        out[n] = last;
+    }
+}
+
+void index_file::hits(uint64_t i, std::vector<index_hit>& out) const
+{
+    index_term const& t = *(index_term const*)this->terms.value (i);
+    // A hit takes two bytes at least, its position and its line.
+    uint64_t count = fitting (t.hits_count, t.hits_offset, this->hit_size, 2);
+    out.resize(count);
+    if (count == 0)
+        return;
+
+    unsigned char const* p = (unsigned char const*)this->hit + 
+        t.hits_offset;
+    unsigned char const* end = (unsigned char const*)this->hit + 
+        this->hit_size;
+    uint64_t last = 0, line = 0;
+    for (uint64_t n = 0; n < count; ++n) {
+        uint64_t pos = last + get_varint (p, end);
+        if (index_file_of (pos) != index_file_of (last))
+            line = 0;
+        line += get_varint (p, end);
+        out[n].pos = last = pos;
+        out[n].line = line;
+    }
+}
+
+bool index_file::hits(char const* word, uint64_t len, 
+    std::vector<index_hit>& out) const
+{
+    uint64_t i = this->terms.find (word, len);
+    if (i == this->terms.size()) {
+        out.clear();
+        return false;
+    }
+    hits (i, out);
+    return true;
+}
+
+bool index_file::lookup(char const* word, uint64_t len, 
+    std::vector<uint64_t>& out) const
+{
+    uint64_t i = this->terms.find (word, len);
+    if (i == this->terms.size()) {
+        out.clear();
+        return false;
+    }
+    postings (i, out);
+    return true;
+}
+
+uint64_t index_file::count(char const* word, uint64_t len) const
+{
+    uint64_t i = this->terms.find (word, len);
+    if (i == this->terms.size())
+        return 0;
+    index_term const& t = *(index_term const*)this->terms.value (i);
+    return fitting (t.count, t.offset, this->post_size, 1);
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
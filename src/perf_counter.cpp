@@ -0,0 +1,92 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <string.h>
+#include <unistd.h>
+
+#include "../include/perf_counter.h"
+#include "../include/stddefines.h"
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* Read accesses of CACHE, or those of them with RESULT. For the NODE 
+   cache the accesses are loads that reach memory and the misses are 
+   those that the local node could not serve. */
+static int open_cache_event (uint64_t cache, uint64_t result)
+{
+    struct perf_event_attr attr;
+    memset (&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (result << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return syscall (__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+cache_counter::cache_counter(cache_type cache, bool enable) 
+    : access_fd(-1), miss_fd(-1)
+{
+#ifdef _LINUX_
+    if (!enable)
+        return;
+
+    uint64_t id = (cache == NODE) ? 
+        PERF_COUNT_HW_CACHE_NODE : PERF_COUNT_HW_CACHE_DTLB;
+    access_fd = open_cache_event (id, PERF_COUNT_HW_CACHE_RESULT_ACCESS);
+    miss_fd = open_cache_event (id, PERF_COUNT_HW_CACHE_RESULT_MISS);
+    if (access_fd < 0 || miss_fd < 0) {
+        if (access_fd >= 0) close (access_fd);
+        if (miss_fd >= 0) close (miss_fd);
+        access_fd = miss_fd = -1;
+        dprintf ("Cache counters unavailable\n");
+    }
+#endif
+}
+
+cache_counter::~cache_counter()
+{
+    if (access_fd >= 0) close (access_fd);
+    if (miss_fd >= 0) close (miss_fd);
+}
+
+bool cache_counter::read(uint64_t& accesses, uint64_t& misses) const
+{
+    if (!valid())
+        return false;
+
+    if (::read (access_fd, &accesses, sizeof(accesses)) != sizeof(accesses) ||
+        ::read (miss_fd, &misses, sizeof(misses)) != sizeof(misses))
+        return false;
+    return true;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,109 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <unistd.h>
+#include <algorithm>
+
+#include "../include/prefetch_reader.h"
+
+prefetch_reader::prefetch_reader(int fd, char* buf, uint64_t size, 
+    int threads) : fd(fd), buf(buf), length(size), next_block(0), ready(0)
+{
+    this->num_blocks = (size + MR_READ_BLOCK - 1) / MR_READ_BLOCK;
+    this->done.resize(this->num_blocks, false);
+    CHECK_ERROR (pthread_mutex_init (&this->mutex, NULL));
+    CHECK_ERROR (pthread_cond_init (&this->cond, NULL));
+
+    threads = std::max(1, std::min(threads, (int)this->num_blocks));
+    this->threads.resize(threads);
+    for (int i = 0; i < threads; ++i)
+        CHECK_ERROR (pthread_create (&this->threads[i], NULL, 
+            reader_main, this));
+}
+
+prefetch_reader::~prefetch_reader()
+{
+    for (size_t i = 0; i < this->threads.size(); ++i)
+        pthread_join (this->threads[i], NULL);
+    pthread_cond_destroy (&this->cond);
+    pthread_mutex_destroy (&this->mutex);
+}
+
+void* prefetch_reader::reader_main(void* arg)
+{
+    prefetch_reader* r = (prefetch_reader*)arg;
+
+    while (true) {
+        // Blocks are handed out in order, so reads are mostly sequential
+        // and the start of the file comes in first.
+        pthread_mutex_lock (&r->mutex);
+        uint64_t block = r->next_block++;
+        pthread_mutex_unlock (&r->mutex);
+
+        if (block >= r->num_blocks)
+            break;
+        r->read_block (block);
+    }
+    return NULL;
+}
+
+void prefetch_reader::read_block(uint64_t block)
+{
+    uint64_t begin = block * MR_READ_BLOCK;
+    uint64_t end = std::min(begin + MR_READ_BLOCK, this->length);
+
+    for (uint64_t pos = begin; pos < end; ) {
+        ssize_t r = pread (this->fd, this->buf + pos, end - pos, pos);
+        CHECK_ERROR (r <= 0);
+        pos += r;
+    }
+
+    pthread_mutex_lock (&this->mutex);
+    this->done[block] = true;
+    uint64_t first = this->ready / MR_READ_BLOCK;
+    if (first == block) {
+        while (first < this->num_blocks && this->done[first])
+            first++;
+        this->ready = std::min(first * MR_READ_BLOCK, this->length);
+        pthread_cond_broadcast (&this->cond);
+    }
+    pthread_mutex_unlock (&this->mutex);
+}
+
+uint64_t prefetch_reader::wait(uint64_t end)
+{
+    end = std::min(end, this->length);
+
+    pthread_mutex_lock (&this->mutex);
+    while (this->ready < end)
+        pthread_cond_wait (&this->cond, &this->mutex);
+    uint64_t ready = this->ready;
+    pthread_mutex_unlock (&this->mutex);
+    return ready;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,136 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <sys/stat.h>
+
+#include "../include/result_file.h"
+
+bool result_file::open(char const* path)
+{
+    close ();
+
+    int fd = ::open (path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat (fd, &st) == 0 && st.st_size >= (off_t)sizeof(result_header))
+        p = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close (fd);
+    if (p == MAP_FAILED)
+        return false;
+
+    if (!open ((char const*)p, st.st_size)) {
+        munmap (p, st.st_size);
+        return false;
+    }
+    this->owned = true;
+    return true;
+}
+
+bool result_file::open(char const* data, uint64_t size)
+{
+    close ();
+    if (size < sizeof(result_header))
+        return false;
+
+    this->map = data;
+    this->map_size = size;
+    this->header = (result_header const*)this->map;
+
+    // Check that the sections fit before trusting them.
+    result_header const& h = *this->header;
+    uint64_t values_at = sizeof(result_header) + 
+        (h.count + 1) * sizeof(uint64_t);
+    uint64_t blob_at = values_at + (h.count * h.value_size + 7) / 8 * 8;
+    if (memcmp (h.magic, RESULT_MAGIC, sizeof(h.magic)) != 0 ||
+        h.count > this->map_size / sizeof(uint64_t) || 
+        h.value_size > this->map_size ||
+        blob_at + h.blob_size != this->map_size) {
+        close ();
+        return false;
+    }
+
+    this->count = h.count;
+    this->offsets = (uint64_t const*)(this->map + sizeof(result_header));
+    this->values = this->map + values_at;
+    this->blob = this->map + blob_at;
+    // key() trusts the offsets: they run from 0 up to the blob size.
+    uint64_t prev = 0;
+    for (uint64_t i = 0; i <= this->count; i++) {
+        if (this->offsets[i] < prev || this->offsets[i] > h.blob_size) {
+            close ();
+            return false;
+        }
+        prev = this->offsets[i];
+    }
+    if (this->offsets[0] != 0 || prev != h.blob_size) {
+        close ();
+        return false;
+    }
+    return true;
+}
+
+void result_file::close()
+{
+    if (this->owned)
+        munmap ((void*)this->map, this->map_size);
+    this->owned = false;
+    this->map = NULL;
+    this->count = 0;
+}
+
+int result_file::compare(uint64_t i, char const* key, uint64_t len) const
+{
+    uint64_t klen;
+    char const* k = this->key (i, klen);
+    int d = memcmp (k, key, std::min(klen, len));
+    if (d != 0)
+        return d;
+    return (klen > len) - (klen < len);
+}
+
+uint64_t result_file::lower_bound(char const* key, uint64_t len) const
+{
+    uint64_t lo = 0, hi = this->count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (compare (mid, key, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint64_t result_file::find(char const* key, uint64_t len) const
+{
+    uint64_t i = lower_bound (key, len);
+    return i < this->count && compare (i, key, len) == 0 ? i : this->count;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
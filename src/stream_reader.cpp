@@ -0,0 +1,248 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "../include/stream_reader.h"
+
+// Room before every block for the end of the previous one, so that a 
+// part that continues into the next block is rarely copied in full.
+#define TAIL_ROOM 4096
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+stream_reader::stream_reader(int fd, uint64_t block) : fd(fd), block(block),
+    eof(false), stop(false), tail(NULL), tail_len(0), tail_buf(NULL), 
+    handed_out(0)
+{
+    CHECK_ERROR (pthread_mutex_init (&this->mutex, NULL));
+    CHECK_ERROR (pthread_cond_init (&this->cond, NULL));
+    CHECK_ERROR (pthread_create (&this->thread, NULL, reader_main, this));
+}
+
+stream_reader::~stream_reader()
+{
+    pthread_mutex_lock (&this->mutex);
+    this->stop = true;
+    pthread_cond_broadcast (&this->cond);
+    pthread_mutex_unlock (&this->mutex);
+    // A read in progress still has to return.
+    pthread_join (this->thread, NULL);
+
+    // Parts not released and the tail, the ring itself goes below.
+    std::map<char const*, buffer_t*>::iterator i;
+    for (i = this->parts.begin(); i != this->parts.end(); ++i)
+        this->unref (i->second);
+    if (this->tail_buf != NULL)
+        this->unref (this->tail_buf);
+    for (size_t i = 0; i < this->buffers.size(); ++i)
+        free (this->buffers[i]);
+    pthread_cond_destroy (&this->cond);
+    pthread_mutex_destroy (&this->mutex);
+}
+
+void* stream_reader::reader_main(void* arg)
+{
+    stream_reader* r = (stream_reader*)arg;
+
+    while (true) {
+        // Wait until there is room ahead and a ring buffer to read into.
+        pthread_mutex_lock (&r->mutex);
+        while (!r->stop && (r->full.size() >= MR_STREAM_AHEAD || 
+            (r->free_bufs.empty() && r->buffers.size() >= MR_STREAM_BUFFERS)))
+            pthread_cond_wait (&r->cond, &r->mutex);
+        bool stop = r->stop;
+        block_t b = { NULL, 0 };
+        if (!stop && !r->free_bufs.empty()) {
+            b.buf = r->free_bufs.back();
+            r->free_bufs.pop_back();
+        } else if (!stop) {
+            b.buf = (char*)malloc (TAIL_ROOM + r->block);
+            CHECK_ERROR (b.buf == NULL);
+            r->buffers.push_back(b.buf);
+        }
+        pthread_mutex_unlock (&r->mutex);
+        if (stop)
+            break;
+
+        // Fill a whole block, short reads are common on pipes.
+        ssize_t n = 1;
+        while (b.len < r->block && n > 0) {
+            n = read (r->fd, b.buf + TAIL_ROOM + b.len, r->block - b.len);
+            if (n < 0 && errno == EINTR)
+                continue;
+            CHECK_ERROR (n < 0);
+            b.len += n;
+        }
+
+        pthread_mutex_lock (&r->mutex);
+        if (b.len > 0)
+            r->full.push_back(b);
+        else
+            r->free_bufs.push_back(b.buf);
+        r->eof = n == 0;
+        pthread_cond_broadcast (&r->cond);
+        pthread_mutex_unlock (&r->mutex);
+        if (n == 0)
+            break;
+    }
+    return NULL;
+}
+
+bool stream_reader::take(block_t& b)
+{
+    pthread_mutex_lock (&this->mutex);
+    while (this->full.empty() && !this->eof)
+        pthread_cond_wait (&this->cond, &this->mutex);
+    bool got = !this->full.empty();
+    if (got) {
+        b = this->full.front();
+        this->full.pop_front();
+        pthread_cond_broadcast (&this->cond);
+    }
+    pthread_mutex_unlock (&this->mutex);
+    return got;
+}
+
+// Drop a reference to B, with the mutex held. The ring buffer goes back 
+// to the reader thread.
+void stream_reader::unref(buffer_t* b)
+{
+    if (--b->refs > 0)
+        return;
+    if (b->ring) {
+        this->free_bufs.push_back(b->mem);
+        pthread_cond_broadcast (&this->cond);
+    } else {
+        free (b->mem);
+    }
+    delete b;
+}
+
+bool stream_reader::next(char const*& data, uint64_t& len, uint64_t& avail)
+{
+    // Start with what was left over last time and add a block, or more
+    // until there is whitespace to cut at.
+    char* buf = (char*)this->tail;
+    uint64_t size = this->tail_len;
+    buffer_t* held = this->tail_buf;
+    uint64_t cut = 0;
+    bool added = false;
+    while (true) {
+        if (added) {
+            // Cut before the last whitespace, like the file splitters.
+            for (cut = size; cut > 1 && !is_space (buf[cut - 1]); cut--)
+                ;
+            if (cut > 1) {
+                cut--;
+                break;
+            }
+        }
+
+        block_t b;
+        if (!take (b)) {
+            cut = size;
+            break;
+        }
+
+        char* start = b.buf + TAIL_ROOM;
+        buffer_t* now = new buffer_t;
+        now->refs = 1;
+        if (size <= TAIL_ROOM) {
+            // The usual case, the tail fits in front of the block.
+            start -= size;
+            memcpy (start, buf, size);
+            now->mem = b.buf;
+            now->ring = true;
+        } else {
+            // A word longer than the room, join the two.
+            start = (char*)malloc (size + b.len);
+            CHECK_ERROR (start == NULL);
+            memcpy (start, buf, size);
+            memcpy (start + size, b.buf + TAIL_ROOM, b.len);
+            now->mem = start;
+            now->ring = false;
+        }
+
+        // The old tail is copied, and a joined block too.
+        pthread_mutex_lock (&this->mutex);
+        if (held != NULL)
+            unref (held);
+        if (!now->ring)
+            this->free_bufs.push_back(b.buf);
+        pthread_cond_broadcast (&this->cond);
+        pthread_mutex_unlock (&this->mutex);
+
+        held = now;
+        buf = start;
+        size += b.len;
+        added = true;
+    }
+
+    if (size == 0) {
+        pthread_mutex_lock (&this->mutex);
+        if (held != NULL)
+            unref (held);
+        pthread_mutex_unlock (&this->mutex);
+        this->tail_buf = NULL;
+        return false;
+    }
+
+    // One reference for the consumer, and the one held for the tail.
+    pthread_mutex_lock (&this->mutex);
+    held->refs++;
+    this->parts[buf] = held;
+    pthread_mutex_unlock (&this->mutex);
+
+    data = buf;
+    len = cut;
+    avail = size;
+    this->tail = buf + cut;
+    this->tail_len = size - cut;
+    this->tail_buf = held;
+    this->handed_out += cut;
+    return true;
+}
+
+void stream_reader::release(char const* data)
+{
+    pthread_mutex_lock (&this->mutex);
+    std::map<char const*, buffer_t*>::iterator i = this->parts.find(data);
+    if (i != this->parts.end()) {
+        unref (i->second);
+        this->parts.erase(i);
+    }
+    pthread_mutex_unlock (&this->mutex);
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
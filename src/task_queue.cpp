@@ -23,20 +23,34 @@
 * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
 * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */ 
+
 #include "../include/task_queue.h"
 #include "../include/synch.h"
+#include "../include/ws_deque.h"
 
 using namespace std;
 
-task_queue::task_queue(int sub_queues, int num_threads)
+#ifndef MR_QUEUE_CHASE_LEV
+
+task_queue::task_queue(int sub_queues, int num_threads, 
+    lock::lock_type lock_type, bool profile_locks)
 {
     this->num_queues = sub_queues;
     this->num_threads = num_threads;
+    this->num_victims = sub_queues;
+    this->profile_locks = profile_locks;
     
     this->queues = new std::deque<task_t>[this->num_queues];
     this->locks = new lock*[this->num_queues];
     for (int i = 0; i < this->num_queues; ++i)
-        this->locks[i] = new lock(this->num_threads);
+        this->locks[i] = lock::create(this->num_threads, lock_type, 
+            profile_locks);
+
+    this->lgrps = new int[this->num_victims];
+    for (int i = 0; i < this->num_victims; ++i)
+        this->lgrps[i] = -1;
+    this->stats = new steal_stats[this->num_threads];
+    reset_steal_stats();
 }
 
 task_queue::~task_queue()
@@ -47,6 +61,8 @@ task_queue::~task_queue()
 
     delete [] this->locks;
     delete [] this->queues;
+    delete [] this->lgrps;
+    delete [] this->stats;
 }
 
 /* Queue TASK at LGRP task queue with locking.
@@ -55,10 +71,7 @@ task_queue::~task_queue()
    randomly selected. TID is required for MCS locking. */
 void task_queue::enqueue (const task_t& task, thread_loc const& loc, int total_tasks, int lgrp)
 {
-    int index = (lgrp < 0) ? 
-        (total_tasks > 0 ? task.id * this->num_queues / total_tasks : rand_r(&loc.seed)) : 
-        lgrp;
-    index %= this->num_queues;
+    int index = queue_for (task, total_tasks, lgrp, &loc.seed);
 
     locks[index]->acquire(loc.thread);
     queues[index].push_back(task);
@@ -71,40 +84,246 @@ void task_queue::enqueue (const task_t& task, thread_loc const& loc, int total_t
    randomly selected. */
 void task_queue::enqueue_seq (const task_t& task, int total_tasks, int lgrp)
 {
-    int index = (lgrp < 0) ? 
-        (total_tasks > 0 ? task.id * this->num_queues / total_tasks : rand()) : 
-        lgrp;
-    index %= this->num_queues;
-    queues[index].push_back(task);    
+    queues[queue_for (task, total_tasks, lgrp, NULL)].push_back(task);
 }
 
-int task_queue::dequeue (task_t& task, thread_loc const& loc)
+void task_queue::enqueue_seq_to (const task_t& task, int queue)
+{
+    queues[queue % this->num_queues].push_back(task);
+}
+
+/* Sub-queue i belongs to thread i, and to thread i + num_queues etc. if
+   there are more threads. The locality group only decides where tasks 
+   are queued and whom to steal from first. */
+int task_queue::own_index (thread_loc const& loc) const
+{
+    return loc.thread % this->num_queues;
+}
+
+int task_queue::pop (int index, task_t& task, thread_loc const& loc)
 {
-    int index = (loc.lgrp < 0) ? loc.cpu : loc.lgrp;
-    
-   /* Do task stealing if nothing on our queue.
-      Cycle through all indexes until success or exhaustion */
     int ret = 0;
-    for (int i = index; i < index + this->num_queues && ret == 0; i++)
+    locks[index]->acquire(loc.thread);
+    if(this->queues[index].size() > 0)
+    {
+        task = this->queues[index].front();
+        this->queues[index].pop_front();
+        ret = 1;
+    }
+    locks[index]->release(loc.thread);
+    return ret;
+}
+
+/* Take the back half of VICTIM's tasks. One is returned in TASK, the 
+   rest are moved to our own queue INDEX. */
+int task_queue::steal_half (int victim, int index, task_t& task, thread_loc const& loc)
+{
+    std::deque<task_t> stolen;
+
+    locks[victim]->acquire(loc.thread);
+    std::deque<task_t>& q = this->queues[victim];
+    size_t n = (q.size() + 1) / 2;
+    stolen.insert(stolen.end(), q.end() - n, q.end());
+    q.erase(q.end() - n, q.end());
+    locks[victim]->release(loc.thread);
+
+    if(n == 0)
+        return 0;
+
+    task = stolen.back();
+    stolen.pop_back();
+    if(stolen.size() > 0)
     {
-        int idx = i % this->num_queues;
-        locks[idx]->acquire(loc.thread);
-        if(this->queues[idx].size() > 0)
+        locks[index]->acquire(loc.thread);
+        this->queues[index].insert(this->queues[index].end(), 
+            stolen.begin(), stolen.end());
+        locks[index]->release(loc.thread);
+    }
+    return 1;
+}
+
+bool task_queue::get_lock_stats (int queue, lock::stats& s) const
+{
+    if (!this->profile_locks)
+        return false;
+    this->locks[queue]->get_stats(s);
+    return true;
+}
+
+void task_queue::reset_lock_stats ()
+{
+    for (int i = 0; i < this->num_queues; ++i)
+        this->locks[i]->reset_stats();
+}
+
+#else /* MR_QUEUE_CHASE_LEV */
+
+task_queue::task_queue(int sub_queues, int num_threads, 
+    lock::lock_type lock_type, bool profile_locks)
+{
+    this->num_queues = sub_queues;
+    this->num_threads = num_threads;
+    this->num_victims = num_threads;
+
+    this->deques = new ws_deque<task_t>*[this->num_threads];
+    for (int i = 0; i < this->num_threads; ++i)
+        this->deques[i] = new ws_deque<task_t>();
+
+    this->lgrps = new int[this->num_victims];
+    for (int i = 0; i < this->num_victims; ++i)
+        this->lgrps[i] = -1;
+    this->stats = new steal_stats[this->num_threads];
+    reset_steal_stats();
+}
+
+task_queue::~task_queue()
+{
+    for (int i = 0; i < this->num_threads; ++i)
+        delete this->deques[i];
+
+    delete [] this->deques;
+    delete [] this->lgrps;
+    delete [] this->stats;
+}
+
+/* Queue TASK on the calling thread's deque. Only the owner may push onto
+   a deque, so the locality hint cannot be honoured here; idle threads in
+   other locality groups will steal the task if needed. */
+void task_queue::enqueue (const task_t& task, thread_loc const& loc, int total_tasks, int lgrp)
+{
+    this->deques[own_index(loc)]->push(task);
+}
+
+/* Queue TASK at LGRP sub-queue without synchronization. Sub-queue i is
+   owned by thread i % num_threads. Must not run concurrently with any 
+   other queue operation. */
+void task_queue::enqueue_seq (const task_t& task, int total_tasks, int lgrp)
+{
+    this->deques[queue_for (task, total_tasks, lgrp, NULL)]->push_seq(task);
+}
+
+void task_queue::enqueue_seq_to (const task_t& task, int queue)
+{
+    this->deques[queue % this->num_threads]->push_seq(task);
+}
+
+int task_queue::own_index (thread_loc const& loc) const
+{
+    return loc.thread % this->num_threads;
+}
+
+int task_queue::pop (int index, task_t& task, thread_loc const& loc)
+{
+    return this->deques[index]->pop(task);
+}
+
+/* Steal up to half of VICTIM's tasks, one at a time since the deque only 
+   supports single item steals. One is returned in TASK, the rest are 
+   pushed onto our own deque INDEX. */
+int task_queue::steal_half (int victim, int index, task_t& task, thread_loc const& loc)
+{
+    ws_deque<task_t>* d = this->deques[victim];
+    ws_deque<task_t>::steal_result r;
+
+    while ((r = d->steal(task)) == ws_deque<task_t>::ABORT)
+        ;
+    if (r != ws_deque<task_t>::SUCCESS)
+        return 0;
+
+    task_t extra;
+    for (uint64_t n = d->size() / 2; n > 0; n--) {
+        while ((r = d->steal(extra)) == ws_deque<task_t>::ABORT)
+            ;
+        if (r != ws_deque<task_t>::SUCCESS)
+            break;
+        this->deques[index]->push(extra);
+    }
+    return 1;
+}
+
+bool task_queue::get_lock_stats (int queue, lock::stats& s) const
+{
+    return false;
+}
+
+void task_queue::reset_lock_stats ()
+{
+}
+
+#endif /* MR_QUEUE_CHASE_LEV */
+
+/* The queue for TASK among the queues that can be robbed: the TASK.id-th
+   share of those whose owner is in locality group LGRP, of all of them 
+   if LGRP is less than 0 or has no queue, or a random one without 
+   TOTAL_TASKS. SEED is for rand_r(), or NULL to use rand(). */
+int task_queue::queue_for (task_t const& task, int total_tasks, int lgrp,
+    unsigned int* seed) const
+{
+    int local = 0;
+    for (int i = 0; lgrp >= 0 && i < this->num_victims; ++i)
+        if (__atomic_load_n(&this->lgrps[i], __ATOMIC_RELAXED) == lgrp)
+            local++;
+
+    int n = local > 0 ? local : this->num_victims;
+    int k = total_tasks > 0 ? task.id * n / total_tasks : 
+        (seed != NULL ? rand_r(seed) : rand());
+    k %= n;
+    if (local == 0)
+        return k;
+
+    // Dequeuing threads may change the groups meanwhile.
+    for (int i = 0; i < this->num_victims; ++i)
+        if (__atomic_load_n(&this->lgrps[i], __ATOMIC_RELAXED) == lgrp && 
+            k-- == 0)
+            return i;
+    return k % this->num_victims;
+}
+
+void task_queue::set_lgrp (int queue, int lgrp)
+{
+    __atomic_store_n(&this->lgrps[queue % this->num_victims], lgrp, 
+        __ATOMIC_RELAXED);
+}
+
+int task_queue::dequeue (task_t& task, thread_loc const& loc)
+{
+    int index = own_index(loc);
+
+    // Remember which locality group this queue serves. Thieves read it 
+    // concurrently, and a stale group only makes a steal less local.
+    if (__atomic_load_n(&this->lgrps[index], __ATOMIC_RELAXED) != loc.lgrp)
+        __atomic_store_n(&this->lgrps[index], loc.lgrp, __ATOMIC_RELAXED);
+
+    int ret = pop(index, task, loc);
+
+    /* Do task stealing if nothing on our queue. Victims are visited in a
+       random rotation, those in our own locality group first, until 
+       success or exhaustion. */
+    if (ret == 0 && this->num_victims > 1)
+    {
+        steal_stats& st = this->stats[loc.thread % this->num_threads];
+        int start = rand_r(&loc.seed) % this->num_victims;
+
+        for (int pass = 0; pass < 2 && ret == 0; pass++)
         {
-            if(idx == index)
-            {
-                task = this->queues[idx].front();
-                this->queues[idx].pop_front();
-            }
-            else
+            for (int i = 0; i < this->num_victims && ret == 0; i++)
             {
-                task = this->queues[idx].back();
-                this->queues[idx].pop_back();
-                dprintf("Stole task from %d to %d\n", idx, index);
+                int idx = (start + i) % this->num_victims;
+                if (idx == index)
+                    continue;
+                bool local = (loc.lgrp < 0 || __atomic_load_n(
+                    &this->lgrps[idx], __ATOMIC_RELAXED) == loc.lgrp);
+                if (local != (pass == 0))
+                    continue;
+
+                st.attempts++;
+                ret = steal_half(idx, index, task, loc);
+                if (ret) {
+                    st.successes++;
+                    dprintf("Stole task from %d to %d\n", idx, index);
+                }
             }
-            ret = 1;
         }
-        locks[idx]->release(loc.thread);
     }
 
     if(ret) {
@@ -115,4 +334,21 @@ int task_queue::dequeue (task_t& task, thread_loc const& loc)
     return ret;
 }
 
+void task_queue::get_steal_stats (uint64_t& attempts, uint64_t& successes) const
+{
+    attempts = successes = 0;
+    for (int i = 0; i < this->num_threads; ++i) {
+        attempts += this->stats[i].attempts;
+        successes += this->stats[i].successes;
+    }
+}
+
+void task_queue::reset_steal_stats ()
+{
+    for (int i = 0; i < this->num_threads; ++i) {
+        this->stats[i].attempts = 0;
+        this->stats[i].successes = 0;
+    }
+}
+
 // vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -26,140 +26,428 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <string.h>
+#include <algorithm>
 
 #include "../include/thread_pool.h"
 #include "../include/atomic.h"
 #include "../include/scheduler.h"
 
-thread_pool::thread_pool(int num_threads, sched_policy const* policy)
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#endif
+
+thread_pool::thread_pool(int num_threads, sched_policy const* policy, 
+    int max_threads)
 {
-    int             ret;
-    pthread_attr_t  attr;
+    this->max_num_threads = std::max(num_threads, max_threads);
+    this->num_threads = 0;
+    this->target_threads = num_threads;
+    this->num_live = 0;
+    this->elastic = false;
+    this->legacy.num_workers = 0;
+    this->legacy.num_args = 0;
+    this->legacy.next_arg = 0;
+    this->legacy.finished = 1;
 
-    this->num_threads = num_threads;
-    this->num_workers = num_threads;
+    // Spinning only pays off if the waiting threads have a CPU of their 
+    // own to spin on.
+    this->spins = (proc_get_num_cpus() > 1) ? MR_SPIN_COUNT : 0;
 
-    this->args = new void*[num_threads];
-    this->threads = new pthread_t[num_threads];
-    this->thread_args = new thread_arg_t[num_threads];
+    this->args = new void*[this->max_num_threads];
+    this->threads = new pthread_t[this->max_num_threads];
+    this->thread_args = new thread_arg_t[this->max_num_threads];
     
-    CHECK_ERROR (pthread_attr_init (&attr));
-    CHECK_ERROR (pthread_attr_setscope (&attr, PTHREAD_SCOPE_SYSTEM));
-    CHECK_ERROR (pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED));
+    CHECK_ERROR (pthread_mutex_init (&this->mutex, NULL));
+    CHECK_ERROR (pthread_cond_init (&this->all_exited, NULL));
+    CHECK_ERROR (pthread_attr_init (&this->attr));
+    CHECK_ERROR (pthread_attr_setscope (&this->attr, PTHREAD_SCOPE_SYSTEM));
+    CHECK_ERROR (pthread_attr_setdetachstate (&this->attr, PTHREAD_CREATE_DETACHED));
 
     this->die = 0;
-    for (int i = 0; i < num_threads; ++i) {
-        /* Initialize thread argument. */
+    for (int i = 0; i < this->max_num_threads; ++i) {
+        /* Initialize thread argument. The CPU of every slot is fixed up 
+           front so that threads added later follow the same policy. */
         this->thread_args[i].pool = this;
         this->thread_args[i].loc.thread = i;
         this->thread_args[i].loc.cpu = policy != NULL ? policy->thr_to_cpu(i) : -1;        
         // we'll get this when the thread runs...
         this->thread_args[i].loc.lgrp = -1;                    
         this->thread_args[i].loc.seed = i;        
-        
-        ret = pthread_create (
-            &this->threads[i], &attr, loop, &this->thread_args[i]);
+        this->thread_args[i].loc.retire = 0;
+        this->thread_args[i].retiring = false;
+        this->thread_args[i].job = NULL;
+        this->thread_args[i].arg = NULL;
+        this->thread_args[i].state = DEAD;
+        this->thread_args[i].tid = -1;
+        this->thread_args[i].sched_run = 0;
+        this->thread_args[i].sched_wait = 0;
     }
+
+    pthread_mutex_lock (&this->mutex);
+    resize_locked (num_threads);
+    pthread_mutex_unlock (&this->mutex);
 }
 
 thread_pool::~thread_pool()
 {
     assert (this->die == 0);
 
-    this->num_workers = this->num_threads;
-    this->num_workers_done = 0;
-
+    pthread_mutex_lock (&this->mutex);
     this->die = 1;
-    for (int i = 0; i < this->num_threads; ++i) {        
-        this->thread_args[i].sem_run.post();
-    }
-    this->sem_all_workers_done.wait();    
+    pthread_mutex_unlock (&this->mutex);
+    this->run_event.signal();
+
+    pthread_mutex_lock (&this->mutex);
+    while (this->num_live > 0)
+        pthread_cond_wait (&this->all_exited, &this->mutex);
+    pthread_mutex_unlock (&this->mutex);
+
+    pthread_attr_destroy (&this->attr);
+    pthread_cond_destroy (&this->all_exited);
+    pthread_mutex_destroy (&this->mutex);
 
     delete [] this->args;
     delete [] this->threads;
     delete [] this->thread_args;
 }
 
-int thread_pool::set(thread_func thread_func, void** args, int num_workers)
+static pthread_once_t shared_once = PTHREAD_ONCE_INIT;
+static thread_pool* shared_pool = NULL;
+
+static void create_shared_pool()
 {
-    this->thread_function = thread_func;
-    assert (num_workers <= this->num_threads);
-    this->num_workers = num_workers;
+    int threads = atoi(GETENV("MR_NUMTHREADS"));
+    if (threads <= 0)
+        threads = proc_get_num_cpus();
 
-    for (int i = 0; i < this->num_workers; ++i)
-    {
-        int j = i * this->num_threads / num_workers;
-        this->args[j] = args[i];
-    }
+    sched_policy_strand_fill policy(0);
+    shared_pool = new thread_pool(threads, &policy, 
+        std::max(threads, proc_get_num_cpus()));
+}
+
+thread_pool* thread_pool::shared()
+{
+    pthread_once (&shared_once, create_shared_pool);
+    return shared_pool;
+}
+
+int thread_pool::set(thread_func thread_func, void** args, int num_workers, 
+    int num_args)
+{
+    this->legacy.func = thread_func;
+    this->legacy.num_workers = num_workers;
+    this->legacy.num_args = std::min(std::max(num_args, num_workers), 
+        this->max_num_threads);
+    this->legacy.args = this->args;
+    assert (num_workers <= this->legacy.num_args);
+
+    for (int i = 0; i < this->legacy.num_args; ++i)
+        this->args[i] = args[i];
 
     return 0;
 }
 
 int thread_pool::begin()
 {
-    if (this->num_workers == 0)
-        return 0;
+    begin_phase (&this->legacy);
+    return 0;
+}
+
+int thread_pool::wait()
+{
+    wait_phase (&this->legacy);
+    return 0;
+}
+
+int thread_pool::run(thread_func thread_func, void** args, int num_workers, 
+    int num_args)
+{
+    phase_t phase;
+    phase.func = thread_func;
+    phase.args = args;
+    phase.num_workers = num_workers;
+    phase.num_args = std::min(std::max(num_args, num_workers), 
+        this->max_num_threads);
 
-    this->num_workers_done = 0;
+    begin_phase (&phase);
+    wait_phase (&phase);
 
-    for (int i = 0; i < this->num_workers; ++i)
-    {
-        int j = i * this->num_threads / num_workers;
-        this->thread_args[j].sem_run.post();
+    return phase.next_arg;
+}
+
+/* Start PHASE on up to its fair share of the idle threads, i.e. the live
+   threads divided by the number of running phases. If there are none it
+   starts as soon as a thread finishes its part of another phase. */
+void thread_pool::begin_phase(phase_t* phase)
+{
+    pthread_mutex_lock (&this->mutex);
+
+    if (this->elastic)
+        adapt();
+
+    phase->next_arg = 0;
+    phase->outstanding = 0;
+    phase->finished = (phase->num_workers <= 0);
+    if (phase->finished) {
+        pthread_mutex_unlock (&this->mutex);
+        return;
     }
+    phase->ran.assign(this->max_num_threads, false);
+    this->running.push_back(phase);
 
-    return 0;
+    std::vector<int> idle;
+    for (int i = 0; i < this->num_threads; ++i)
+        if (this->thread_args[i].job == NULL && !this->thread_args[i].loc.retire)
+            idle.push_back(i);
+
+    int share = (this->num_threads + this->running.size() - 1) / 
+        this->running.size();
+    int workers = std::min(std::min(phase->num_workers, share), 
+        (int)idle.size());
+
+    // spread the workers over the idle threads.
+    for (int i = 0; i < workers; ++i)
+        assign (&this->thread_args[idle[i * idle.size() / workers]], phase);
+
+    pthread_mutex_unlock (&this->mutex);
+
+    if (workers > 0)
+        this->run_event.signal();
 }
 
-int thread_pool::wait()
+void thread_pool::wait_phase(phase_t* phase)
+{
+    while (!phase->finished) {
+        unsigned int gen = this->done_event.generation();
+        if (phase->finished)
+            break;
+        this->done_event.wait(gen, this->spins);
+    }
+
+    // the last thread to leave is done with PHASE once it drops the lock.
+    pthread_mutex_lock (&this->mutex);
+    pthread_mutex_unlock (&this->mutex);
+}
+
+/* Hand THREAD_ARG the next argument of PHASE. Called with the mutex held. */
+void thread_pool::assign(thread_arg_t* thread_arg, phase_t* phase)
 {
-    if (this->num_workers == 0)
-        return 0;
+    phase->ran[thread_arg->loc.thread] = true;
+    phase->outstanding++;
+    thread_arg->arg = phase->args[phase->next_arg++];
+    asm("" ::: "memory");
+    thread_arg->job = phase;
+}
 
-    this->sem_all_workers_done.wait();
+int thread_pool::resize(int num_threads)
+{
+    pthread_mutex_lock (&this->mutex);
+    this->target_threads = std::max(1, std::min(num_threads, 
+        this->max_num_threads));
+    int ret = resize_locked (this->target_threads);
+    pthread_mutex_unlock (&this->mutex);
 
+    // wake idle threads that were just retired.
+    this->run_event.signal();
+    return ret;
+}
+
+void thread_pool::set_elastic(bool elastic)
+{
+    pthread_mutex_lock (&this->mutex);
+    this->elastic = elastic;
+    pthread_mutex_unlock (&this->mutex);
+}
+
+/* Live threads always occupy slots [0, num_threads). Growing revives 
+   retired threads that have not exited yet and starts new ones for the 
+   rest; shrinking retires the highest slots, those in a phase when they 
+   leave it. Called with the mutex held. */
+int thread_pool::resize_locked(int num_threads)
+{
+    num_threads = std::max(1, std::min(num_threads, this->max_num_threads));
+
+    for (int i = this->num_threads; i < num_threads; ++i) {
+        thread_arg_t* t = &this->thread_args[i];
+        t->loc.retire = 0;
+        t->retiring = false;
+        if (t->state == DEAD) {
+            t->state = ALIVE;
+            t->job = NULL;
+            t->sched_run = t->sched_wait = 0;
+            this->num_live++;
+            CHECK_ERROR (pthread_create (&this->threads[i], &this->attr, 
+                loop, t));
+        }
+    }
+
+    for (int i = num_threads; i < this->num_threads; ++i) {
+        thread_arg_t* t = &this->thread_args[i];
+        if (t->job == NULL)
+            t->loc.retire = 1;
+        else
+            t->retiring = true;
+    }
+
+    this->num_threads = num_threads;
     return 0;
 }
 
+/* Shrink when the pool's threads spend a large part of their runnable 
+   time waiting for a CPU (other processes compete for our cores), grow
+   back towards the requested size when they don't. Uses the per-thread 
+   run queue delay from /proc/self/task/<tid>/schedstat. */
+void thread_pool::adapt()
+{
+#ifdef _LINUX_
+    uint64_t run = 0, wait = 0;
+
+    for (int i = 0; i < this->num_threads; ++i) {
+        thread_arg_t* t = &this->thread_args[i];
+        if (t->tid < 0)
+            continue;
+
+        char path[64];
+        unsigned long long r, w;
+        snprintf (path, sizeof(path), "/proc/self/task/%ld/schedstat", t->tid);
+        FILE* f = fopen (path, "r");
+        if (f == NULL)
+            continue;
+        if (fscanf (f, "%llu %llu", &r, &w) == 2) {
+            if (t->sched_run > 0) {
+                run += r - t->sched_run;
+                wait += w - t->sched_wait;
+            }
+            t->sched_run = r;
+            t->sched_wait = w;
+        }
+        fclose (f);
+    }
+
+    // Wait for a meaningful sample, ~1ms of runnable time per thread.
+    if (run + wait < 1000000ULL * this->num_threads)
+        return;
+
+    double ratio = wait / (double)(run + wait);
+    if (ratio > MR_ELASTIC_SHRINK && this->num_threads > 1) {
+        dprintf("Pool: run queue wait %.2f, shrinking\n", ratio);
+        resize_locked (this->num_threads - std::max(1, this->num_threads / 4));
+    } else if (ratio < MR_ELASTIC_GROW && 
+        this->num_threads < this->target_threads) {
+        dprintf("Pool: run queue wait %.2f, growing\n", ratio);
+        resize_locked (this->num_threads + 1);
+    }
+#endif
+}
+
+/* Join the running phase with the fewest threads that has a spare 
+   argument and that this thread has not taken part in yet, a phase 
+   passes every thread slot at most once. Called with the mutex held. */
+bool thread_pool::join_phase(thread_arg_t* thread_arg)
+{
+    if (this->die || thread_arg->loc.retire)
+        return false;
+
+    phase_t* best = NULL;
+    for (size_t i = 0; i < this->running.size(); ++i) {
+        phase_t* p = this->running[i];
+        if (p->next_arg < p->num_args && !p->ran[thread_arg->loc.thread] &&
+            (best == NULL || p->outstanding < best->outstanding))
+            best = p;
+    }
+
+    if (best == NULL)
+        return false;
+    assign (thread_arg, best);
+    return true;
+}
+
+/* The calling thread is done with its phase. The last one out finishes
+   it. Either way the thread moves on to another phase if it can. */
+void thread_pool::leave_phase(thread_arg_t* thread_arg)
+{
+    bool finished = false;
+
+    pthread_mutex_lock (&this->mutex);
+    phase_t* phase = thread_arg->job;
+    thread_arg->job = NULL;
+    if (thread_arg->retiring) {
+        thread_arg->retiring = false;
+        thread_arg->loc.retire = 1;
+    }
+    if (--phase->outstanding == 0) {
+        this->running.erase(std::find(this->running.begin(), 
+            this->running.end(), phase));
+        phase->finished = 1;
+        finished = true;
+    }
+    join_phase (thread_arg);
+    pthread_mutex_unlock (&this->mutex);
+
+    if (finished)
+        this->done_event.signal();
+}
+
+/* Returns true if the calling thread must exit, i.e. the pool is dying or
+   the thread has been retired and not revived since. */
+bool thread_pool::exit_thread(thread_arg_t* thread_arg)
+{
+    bool exit = false;
+
+    pthread_mutex_lock (&this->mutex);
+    if (this->die || thread_arg->loc.retire) {
+        thread_arg->state = DEAD;
+        thread_arg->tid = -1;
+        if (--this->num_live == 0)
+            pthread_cond_signal (&this->all_exited);
+        exit = true;
+    }
+    pthread_mutex_unlock (&this->mutex);
+
+    return exit;
+}
+
 void* thread_pool::loop(void* arg)
 {
     thread_arg_t*    thread_arg = (thread_arg_t*)arg;
     
     assert (thread_arg);
 
-    thread_func     thread_func;
     thread_pool*    pool = thread_arg->pool;
     thread_loc&        loc = thread_arg->loc;
-    void            *thread_func_arg;
     
     if(loc.cpu >= 0)
         proc_bind_thread (loc.cpu);
         
     loc.lgrp = loc_get_lgrp();
+#ifdef _LINUX_
+    thread_arg->tid = syscall(SYS_gettid);
+#endif
 
-    while (!pool->die)
+    // Unless begin() already picked us, try to join a running phase.
+    pthread_mutex_lock (&pool->mutex);
+    if (thread_arg->job == NULL)
+        pool->join_phase(thread_arg);
+    pthread_mutex_unlock (&pool->mutex);
+
+    while (true)
     {
-        thread_arg->sem_run.wait();
-        if (pool->die)
-            break;
-        
-        thread_func = *(pool->thread_function);
-        thread_func_arg = pool->args[loc.thread];        
-        
-        // Run thread function.
-        (*thread_func)(thread_func_arg, loc);
-        
-        int num_workers_done = fetch_and_inc(&pool->num_workers_done) + 1;        
-        if (num_workers_done == pool->num_workers) {            
-            // Everybody's done.
-            pool->sem_all_workers_done.post();
-        }        
-    }
+        // Read the generation first so that a phase assigned after the 
+        // check below still wakes us up.
+        unsigned int gen = pool->run_event.generation();
+        phase_t* job = thread_arg->job;
 
-    int num_workers_done = fetch_and_inc(&pool->num_workers_done) + 1;        
-    if (num_workers_done == pool->num_workers) {            
-        // Everybody's done.
-        pool->sem_all_workers_done.post();
+        if (job != NULL) {
+            // Run thread function.
+            (*job->func)(thread_arg->arg, loc);
+
+            pool->leave_phase(thread_arg);
+        }
+        else if ((pool->die || loc.retire) && pool->exit_thread(thread_arg))
+            break;
+        else
+            pool->run_event.wait(gen, pool->spins);
     }
 
     return NULL;
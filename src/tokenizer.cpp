@@ -0,0 +1,194 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TOKENIZER_X86
+#endif
+
+#include "../include/tokenizer.h"
+
+static void classify_scalar (char const* data, uint64_t blocks, 
+    tokenizer_masks* out)
+{
+    for (uint64_t b = 0; b < blocks; b++, data += 64) {
+        tokenizer_masks m = { 0, 0, 0 };
+        for (int i = 0; i < 64; i++) {
+            unsigned char c = data[i] | 0x20;
+            m.letters |= (uint64_t)(c >= 'a' && c <= 'z') << i;
+            m.apostrophes |= (uint64_t)(data[i] == '\'') << i;
+            m.newlines |= (uint64_t)(data[i] == '\n') << i;
+        }
+        out[b] = m;
+    }
+}
+
+#ifdef __SSE2__
+// Letters are the bytes that, with the case bit set and moved so that 'a'
+// is the smallest signed byte, are below 26 more than that.
+static void classify_sse2 (char const* data, uint64_t blocks, 
+    tokenizer_masks* out)
+{
+    __m128i const case_bit = _mm_set1_epi8 (0x20);
+    __m128i const shift = _mm_set1_epi8 ((char)(128 - 'a'));
+    __m128i const limit = _mm_set1_epi8 ((char)(-128 + 26));
+    __m128i const quote = _mm_set1_epi8 ('\'');
+    __m128i const newline = _mm_set1_epi8 ('\n');
+
+    for (uint64_t b = 0; b < blocks; b++, data += 64) {
+        tokenizer_masks m = { 0, 0, 0 };
+        for (int k = 0; k < 4; k++) {
+            __m128i x = _mm_loadu_si128 ((__m128i const*)(data + 16 * k));
+            __m128i f = _mm_add_epi8 (_mm_or_si128 (x, case_bit), shift);
+            m.letters |= (uint64_t)(uint32_t)_mm_movemask_epi8 (
+                _mm_cmplt_epi8 (f, limit)) << (16 * k);
+            m.apostrophes |= (uint64_t)(uint32_t)_mm_movemask_epi8 (
+                _mm_cmpeq_epi8 (x, quote)) << (16 * k);
+            m.newlines |= (uint64_t)(uint32_t)_mm_movemask_epi8 (
+                _mm_cmpeq_epi8 (x, newline)) << (16 * k);
+        }
+        out[b] = m;
+    }
+}
+#endif
+
+#ifdef TOKENIZER_X86
+// The same 32 bytes at a time, for processors that have AVX2.
+__attribute__((target("avx2")))
+static void classify_avx2 (char const* data, uint64_t blocks, 
+    tokenizer_masks* out)
+{
+    __m256i const case_bit = _mm256_set1_epi8 (0x20);
+    __m256i const shift = _mm256_set1_epi8 ((char)(128 - 'a'));
+    __m256i const limit = _mm256_set1_epi8 ((char)(-128 + 26));
+    __m256i const quote = _mm256_set1_epi8 ('\'');
+    __m256i const newline = _mm256_set1_epi8 ('\n');
+
+    for (uint64_t b = 0; b < blocks; b++, data += 64) {
+        tokenizer_masks m = { 0, 0, 0 };
+        for (int k = 0; k < 2; k++) {
+            __m256i x = _mm256_loadu_si256 ((__m256i const*)(data + 32 * k));
+            __m256i f = _mm256_add_epi8 (_mm256_or_si256 (x, case_bit), 
+                shift);
+            m.letters |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (
+                _mm256_cmpgt_epi8 (limit, f)) << (32 * k);
+            m.apostrophes |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (
+                _mm256_cmpeq_epi8 (x, quote)) << (32 * k);
+            m.newlines |= (uint64_t)(uint32_t)_mm256_movemask_epi8 (
+                _mm256_cmpeq_epi8 (x, newline)) << (32 * k);
+        }
+        out[b] = m;
+    }
+}
+#endif
+
+static tokenizer_isa current_isa;
+static tokenizer_classify_t current;
+
+static bool supported (tokenizer_isa isa)
+{
+    switch (isa) {
+    case TOKENIZER_SCALAR:
+        return true;
+    case TOKENIZER_SSE2:
+#ifdef __SSE2__
+        return true;
+#else
+        return false;
+#endif
+    case TOKENIZER_AVX2:
+#ifdef TOKENIZER_X86
+        return __builtin_cpu_supports ("avx2");
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+static tokenizer_isa choose (tokenizer_isa isa)
+{
+    while (!supported (isa))
+        isa = (tokenizer_isa)(isa - 1);
+
+    switch (isa) {
+#ifdef TOKENIZER_X86
+    case TOKENIZER_AVX2: current = classify_avx2; break;
+#endif
+#ifdef __SSE2__
+    case TOKENIZER_SSE2: current = classify_sse2; break;
+#endif
+    default: current = classify_scalar; break;
+    }
+    current_isa = isa;
+    return isa;
+}
+
+// The best there is, or the one MR_SIMD names.
+static pthread_once_t classify_once = PTHREAD_ONCE_INIT;
+
+static void choose_default ()
+{
+    char const* simd = getenv ("MR_SIMD");
+    tokenizer_isa isa = TOKENIZER_AVX2;
+    for (int i = TOKENIZER_SCALAR; simd != NULL && i <= TOKENIZER_AVX2; i++)
+        if (strcmp (simd, tokenizer_name ((tokenizer_isa)i)) == 0)
+            isa = (tokenizer_isa)i;
+    if (simd != NULL && strcmp (simd, "0") == 0)
+        isa = TOKENIZER_SCALAR;
+    choose (isa);
+}
+
+tokenizer_isa tokenizer_use (tokenizer_isa isa)
+{
+    // Choose the default first, so that it does not replace ISA later.
+    pthread_once (&classify_once, choose_default);
+    return choose (isa);
+}
+
+tokenizer_classify_t tokenizer_classify ()
+{
+    pthread_once (&classify_once, choose_default);
+    return current;
+}
+
+tokenizer_isa tokenizer_current ()
+{
+    tokenizer_classify ();
+    return current_isa;
+}
+
+char const* tokenizer_name (tokenizer_isa isa)
+{
+    static char const* names[] = { "scalar", "sse2", "avx2" };
+    return names[isa];
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
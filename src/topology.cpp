@@ -0,0 +1,355 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <map>
+#include <string>
+
+#if defined(_LINUX_) && defined(NUMA_SUPPORT)
+#include <numa.h>
+#endif
+
+#include "../include/topology.h"
+#include "../include/stddefines.h"
+
+bool parse_cpu_list (char const* str, std::vector<int>& ids)
+{
+    ids.clear();
+    while (*str != '\0' && *str != '\n') {
+        char* end;
+        long first = strtol (str, &end, 10), last = first;
+        if (end == str || first < 0)
+            return false;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol (str, &end, 10);
+            if (end == str || last < first)
+                return false;
+        }
+        for (long i = first; i <= last; ++i)
+            ids.push_back(i);
+        str = end;
+        if (*str == ',')
+            ++str;
+    }
+    return true;
+}
+
+bool sysfs_read (char const* path, char* buf, int size)
+{
+    char const* root = getenv("MR_SYSFS_ROOT");
+    char full[512];
+    snprintf (full, sizeof(full), "%s/%s", root != NULL ? root : "/sys", path);
+
+    FILE* f = fopen (full, "r");
+    if (f == NULL)
+        return false;
+    int n = fread (buf, 1, size - 1, f);
+    fclose (f);
+    buf[n > 0 ? n : 0] = '\0';
+    return n > 0;
+}
+
+static int sysfs_read_int (char const* path, int fallback)
+{
+    char buf[64];
+    return sysfs_read (path, buf, sizeof(buf)) ? atoi(buf) : fallback;
+}
+
+static pthread_once_t allowance_once = PTHREAD_ONCE_INIT;
+static std::vector<int>* allowed_cpus = NULL;
+static int cpu_limit = 0;
+
+/* The quota of cgroup directory DIR in CPUs, or 0 if it has none. DIR is
+   relative to the sysfs root. */
+static int read_cpu_quota (std::string const& dir)
+{
+    char buf[128];
+    long long quota = -1, period = 0;
+
+    if (sysfs_read ((dir + "/cpu.max").c_str(), buf, sizeof(buf))) {
+        // v2: "<quota> <period>", the quota being "max" if unlimited.
+        if (sscanf (buf, "%lld %lld", &quota, &period) != 2)
+            return 0;
+    } else if (sysfs_read ((dir + "/cpu.cfs_quota_us").c_str(), 
+        buf, sizeof(buf))) {
+        // v1: -1 if unlimited.
+        quota = atoll (buf);
+        if (sysfs_read ((dir + "/cpu.cfs_period_us").c_str(), 
+            buf, sizeof(buf)))
+            period = atoll (buf);
+    }
+
+    if (quota <= 0 || period <= 0)
+        return 0;
+    return (quota + period - 1) / period;
+}
+
+/* Look for the smallest quota on the path from the process's cgroup up
+   to the root of the hierarchy, which is where a container usually 
+   sees its own group. */
+static int read_cgroup_limit ()
+{
+    FILE* f = fopen ("/proc/self/cgroup", "r");
+    if (f == NULL)
+        return 0;
+
+    int limit = 0;
+    char line[1024];
+    while (fgets (line, sizeof(line), f) != NULL) {
+        // "<id>:<controllers>:<path>", controllers empty for v2.
+        char* controllers = strchr (line, ':');
+        char* path = controllers ? strchr (controllers + 1, ':') : NULL;
+        if (path == NULL)
+            continue;
+        *path++ = '\0';
+        path[strcspn (path, "\n")] = '\0';
+        controllers++;
+
+        std::vector<std::string> mounts;
+        if (*controllers == '\0') {
+            mounts.push_back("fs/cgroup");
+        } else {
+            std::string list = std::string(",") + controllers + ",";
+            if (list.find(",cpu,") == std::string::npos)
+                continue;
+            mounts.push_back(std::string("fs/cgroup/") + controllers);
+            mounts.push_back("fs/cgroup/cpu");
+            mounts.push_back("fs/cgroup/cpu,cpuacct");
+        }
+
+        for (size_t m = 0; m < mounts.size(); ++m) {
+            std::string dir = path;
+            while (true) {
+                int quota = read_cpu_quota (mounts[m] + dir);
+                if (quota > 0 && (limit == 0 || quota < limit))
+                    limit = quota;
+                if (dir.empty() || dir == "/")
+                    break;
+                dir.erase(dir.find_last_of('/'));
+            }
+        }
+    }
+    fclose (f);
+    return limit;
+}
+
+static void read_allowance ()
+{
+    allowed_cpus = new std::vector<int>();
+#ifdef _LINUX_
+    cpu_set_t cpu_set;
+    if (sched_getaffinity (0, sizeof(cpu_set), &cpu_set) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; ++i)
+            if (CPU_ISSET (i, &cpu_set))
+                allowed_cpus->push_back(i);
+    }
+    cpu_limit = read_cgroup_limit ();
+#endif
+}
+
+std::vector<int> const& proc_allowed_cpus ()
+{
+    pthread_once (&allowance_once, read_allowance);
+    return *allowed_cpus;
+}
+
+int cgroup_cpu_limit ()
+{
+    pthread_once (&allowance_once, read_allowance);
+    return cpu_limit;
+}
+
+cpu_topology::cpu_topology() : nodes(0)
+{
+#ifdef _LINUX_
+    read_nodes();
+    read();
+    order();
+#endif
+}
+
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static cpu_topology* topology = NULL;
+
+static void create_topology()
+{
+    topology = new cpu_topology();
+}
+
+cpu_topology const& cpu_topology::get()
+{
+    pthread_once (&topology_once, create_topology);
+    return *topology;
+}
+
+void cpu_topology::read()
+{
+    char path[256], buf[4096];
+    std::vector<int> online, list;
+
+    if (!sysfs_read ("devices/system/cpu/online", buf, sizeof(buf)) ||
+        !parse_cpu_list (buf, online))
+        return;
+
+    std::map<std::pair<int, int>, int> cores;
+    for (size_t i = 0; i < online.size(); ++i) {
+        cpu c;
+        c.id = online[i];
+
+        snprintf (path, sizeof(path), 
+            "devices/system/cpu/cpu%d/topology/physical_package_id", c.id);
+        c.package = sysfs_read_int (path, 0);
+
+        // core ids repeat across packages, number them globally.
+        snprintf (path, sizeof(path), 
+            "devices/system/cpu/cpu%d/topology/core_id", c.id);
+        std::pair<int, int> key(c.package, sysfs_read_int (path, c.id));
+        if (cores.find(key) == cores.end()) {
+            int n = cores.size();
+            cores[key] = n;
+        }
+        c.core = cores[key];
+
+        c.smt = 0;
+        snprintf (path, sizeof(path), 
+            "devices/system/cpu/cpu%d/topology/thread_siblings_list", c.id);
+        if (sysfs_read (path, buf, sizeof(buf)) && parse_cpu_list (buf, list))
+            c.smt = std::find(list.begin(), list.end(), c.id) - list.begin();
+
+        // the highest cache level, named after its lowest CPU.
+        c.llc = -1;
+        int level = 0;
+        for (int index = 0; ; ++index) {
+            snprintf (path, sizeof(path), 
+                "devices/system/cpu/cpu%d/cache/index%d/level", c.id, index);
+            int l = sysfs_read_int (path, -1);
+            if (l < 0)
+                break;
+            snprintf (path, sizeof(path), 
+                "devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list", 
+                c.id, index);
+            if (l > level && sysfs_read (path, buf, sizeof(buf)) && 
+                parse_cpu_list (buf, list) && !list.empty()) {
+                level = l;
+                c.llc = *std::min_element(list.begin(), list.end());
+            }
+        }
+        if (c.llc < 0)
+            c.llc = -1 - c.package;
+
+        c.node = node_of(c.id);
+
+        cpus.push_back(c);
+    }
+}
+
+/* Build the CPU to node map from the cpulist of every online node. Node
+   and CPU numbers need not be contiguous, and a node's CPUs need not be
+   either: many two socket machines put the even CPUs on node 0 and the 
+   odd ones on node 1. */
+void cpu_topology::read_nodes()
+{
+    char path[256], buf[4096];
+    std::vector<int> online, list;
+
+    if (sysfs_read ("devices/system/node/online", buf, sizeof(buf)) &&
+        parse_cpu_list (buf, online))
+    {
+        for (size_t i = 0; i < online.size(); ++i) {
+            snprintf (path, sizeof(path), 
+                "devices/system/node/node%d/cpulist", online[i]);
+            if (!sysfs_read (path, buf, sizeof(buf)) || 
+                !parse_cpu_list (buf, list))
+                continue;
+            for (size_t j = 0; j < list.size(); ++j) {
+                if (list[j] >= (int)cpu_node.size())
+                    cpu_node.resize(list[j] + 1, -1);
+                cpu_node[list[j]] = online[i];
+            }
+            nodes = std::max(nodes, online[i] + 1);
+        }
+        return;
+    }
+
+#if defined(_LINUX_) && defined(NUMA_SUPPORT)
+    // No sysfs node directory, ask libnuma instead.
+    if (numa_available() < 0)
+        return;
+    int max_cpu = numa_num_configured_cpus();
+    cpu_node.resize(max_cpu, -1);
+    for (int cpu = 0; cpu < max_cpu; ++cpu)
+        cpu_node[cpu] = numa_node_of_cpu(cpu);
+    nodes = numa_max_node() + 1;
+#endif
+}
+
+struct core_fill_less
+{
+    bool operator()(cpu_topology::cpu const& a, cpu_topology::cpu const& b) const
+    {
+        if (a.smt != b.smt) return a.smt < b.smt;
+        if (a.package != b.package) return a.package < b.package;
+        if (a.llc != b.llc) return a.llc < b.llc;
+        if (a.core != b.core) return a.core < b.core;
+        return a.id < b.id;
+    }
+};
+
+void cpu_topology::order()
+{
+    std::vector<cpu> sorted(cpus);
+    std::sort(sorted.begin(), sorted.end(), core_fill_less());
+
+    by_core.clear();
+    for (size_t i = 0; i < sorted.size(); ++i)
+        by_core.push_back(sorted[i].id);
+
+    /* Rank every CPU among the CPUs of its package with the same SMT 
+       index, in core fill order, then deal the ranks out round robin
+       over the packages. */
+    std::map<std::pair<int, int>, int> next_rank;
+    std::vector< std::pair<std::pair<int, int>, std::pair<int, int> > > keys;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        cpu const& c = sorted[i];
+        int rank = next_rank[std::make_pair(c.smt, c.package)]++;
+        keys.push_back(std::make_pair(std::make_pair(c.smt, rank), 
+            std::make_pair(c.package, c.id)));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    by_chip.clear();
+    for (size_t i = 0; i < keys.size(); ++i)
+        by_chip.push_back(keys[i].second.second);
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
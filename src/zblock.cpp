@@ -0,0 +1,162 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#include "../include/zblock.h"
+
+static inline bool is_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool pread_all (int fd, void* buf, uint64_t len, uint64_t offset)
+{
+    for (uint64_t done = 0; done < len; ) {
+        ssize_t r = pread (fd, (char*)buf + done, len - done, offset + done);
+        if (r <= 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+static bool write_all (int fd, void const* buf, uint64_t len)
+{
+    for (uint64_t done = 0; done < len; ) {
+        ssize_t r = write (fd, (char const*)buf + done, len - done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+            return false;
+        done += r;
+    }
+    return true;
+}
+
+int zblock_read_index (int fd, std::vector<zblock_entry>& index)
+{
+    zblock_header h;
+    struct stat st;
+    if (!pread_all (fd, &h, sizeof(h), 0) || 
+        memcmp (h.magic, ZBLOCK_MAGIC, sizeof(h.magic)) != 0)
+        return 0;
+
+    // Check the sizes before allocating anything by them.
+    index.clear();
+    uint64_t size = fstat (fd, &st) < 0 ? 0 : st.st_size;
+    if (size < sizeof(h) || 
+        h.num_blocks > (size - sizeof(h)) / sizeof(zblock_entry))
+        return -1;
+
+    index.resize(h.num_blocks);
+    if (h.num_blocks > 0 && !pread_all (fd, &index[0], 
+        h.num_blocks * sizeof(zblock_entry), sizeof(h)))
+        return -1;
+
+    uint64_t start = sizeof(h) + h.num_blocks * sizeof(zblock_entry);
+    uint64_t raw = 0;
+    for (size_t i = 0; i < index.size(); ++i) {
+        zblock_entry const& e = index[i];
+        if (e.offset < start || e.offset > size || e.len > size - e.offset ||
+            e.raw_offset != raw || 
+            e.raw_len > (uint64_t)e.len * ZBLOCK_MAX_RATIO)
+            return -1;
+        raw += e.raw_len;
+    }
+    return raw == h.raw_size ? 1 : -1;
+}
+
+bool zblock_decompress (char const* file, uint64_t size, 
+    zblock_entry const& e, char* out)
+{
+    if (e.offset > size || e.len > size - e.offset)
+        return false;
+
+    uLongf len = e.raw_len;
+    return uncompress ((Bytef*)out, &len, (Bytef const*)file + e.offset, 
+        e.len) == Z_OK && len == e.raw_len;
+}
+
+bool zblock_write (int fd, char const* data, uint64_t size, 
+    uint64_t block_size, int level)
+{
+    // Cut after the whitespace following every block's nominal end, so 
+    // that blocks start with a word. Splitting them again then cuts at 
+    // the same places as splitting the text.
+    std::vector<zblock_entry> index;
+    for (uint64_t pos = 0; pos < size; ) {
+        uint64_t end = std::min(pos + block_size, size);
+        while (end < size && !is_space (data[end]))
+            end++;
+        while (end < size && is_space (data[end]))
+            end++;
+        if (end - pos > 0xffffffffULL) {
+            errno = EFBIG;
+            return false;
+        }
+
+        zblock_entry e = { 0, pos, 0, (uint32_t)(end - pos) };
+        index.push_back(e);
+        pos = end;
+    }
+
+    zblock_header h;
+    memcpy (h.magic, ZBLOCK_MAGIC, sizeof(h.magic));
+    h.num_blocks = index.size();
+    h.raw_size = size;
+
+    // The index goes before the blocks, write them after it and the index
+    // once their sizes are known.
+    uint64_t offset = sizeof(h) + index.size() * sizeof(zblock_entry);
+    if (lseek (fd, offset, SEEK_SET) < 0)
+        return false;
+
+    std::vector<Bytef> buf;
+    for (size_t i = 0; i < index.size(); ++i) {
+        uLongf len = compressBound (index[i].raw_len);
+        buf.resize(len);
+        if (compress2 (&buf[0], &len, (Bytef const*)data + index[i].raw_offset,
+            index[i].raw_len, level) != Z_OK || !write_all (fd, &buf[0], len))
+            return false;
+        index[i].offset = offset;
+        index[i].len = len;
+        offset += len;
+    }
+
+    return lseek (fd, 0, SEEK_SET) == 0 && write_all (fd, &h, sizeof(h)) &&
+        write_all (fd, index.empty() ? NULL : &index[0], 
+            index.size() * sizeof(zblock_entry));
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
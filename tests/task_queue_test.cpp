@@ -0,0 +1,139 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Checks how the locked task queue places and steals tasks: every thread
+   pops its own sub-queue, tasks queued for a locality group go to the 
+   queues of its threads, and a thief robs the queues of its own group 
+   first and keeps half of what it takes. The four queues here belong to
+   threads 0 and 1 in group 0 and threads 2 and 3 in group 1. */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "task_queue.h"
+
+static int failures = 0;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__,  \
+                #cond);                                                 \
+            ++failures;                                                 \
+        }                                                               \
+    } while (0)
+
+static task_queue* make_queue()
+{
+    task_queue* q = new task_queue(4, 4, lock::MUTEX);
+    q->set_lgrp(0, 0);
+    q->set_lgrp(1, 0);
+    q->set_lgrp(2, 1);
+    q->set_lgrp(3, 1);
+    return q;
+}
+
+// Task MARK, queued for LGRP as the SHARE-th of two.
+static void put(task_queue* q, uint64_t mark, int lgrp, int share)
+{
+    task_queue::task_t task = { (uint64_t)share, 0, 0, mark };
+    q->enqueue_seq(task, 2, lgrp);
+}
+
+int main(int argc, char *argv[])
+{
+    task_queue::task_t task;
+    uint64_t attempts, steals;
+
+    // A thread takes its own queue's task without stealing.
+    {
+        task_queue* q = make_queue();
+        put(q, 2, 1, 0);
+        put(q, 3, 1, 1);
+        thread_loc loc = { 3, -1, 1, 1, 0 };
+        EXPECT(q->dequeue(task, loc) && task.pad == 3);
+        q->get_steal_stats(attempts, steals);
+        EXPECT(attempts == 0);
+        delete q;
+    }
+
+    // Whatever the victim rotation starts at, queue 1 of our own group is
+    // robbed before queue 2 of the other one.
+    for (unsigned int seed = 0; seed < 64; seed++) {
+        task_queue* q = make_queue();
+        put(q, 1, 0, 1);
+        put(q, 2, 1, 0);
+        thread_loc loc = { 0, -1, 0, seed, 0 };
+        EXPECT(q->dequeue(task, loc) && task.pad == 1);
+        EXPECT(q->dequeue(task, loc) && task.pad == 2);
+        EXPECT(!q->dequeue(task, loc));
+        delete q;
+    }
+
+    // Of four tasks, the thief returns one and keeps one on its own queue.
+    {
+        task_queue* q = make_queue();
+        for (int i = 0; i < 4; i++)
+            put(q, 1, 0, 1);
+        thread_loc thief = { 0, -1, 0, 1, 0 };
+        EXPECT(q->dequeue(task, thief) && task.pad == 1);
+        q->get_steal_stats(attempts, steals);
+        EXPECT(steals == 1);
+        EXPECT(q->dequeue(task, thief) && task.pad == 1);
+        q->get_steal_stats(attempts, steals);
+        EXPECT(steals == 1);
+
+        thread_loc owner = { 1, -1, 0, 1, 0 };
+        EXPECT(q->dequeue(task, owner));
+        EXPECT(q->dequeue(task, owner));
+        EXPECT(!q->dequeue(task, owner));
+        delete q;
+    }
+
+    // A task queued for a thread's queue is popped by that thread, even 
+    // if the queue's group has other queues.
+    {
+        task_queue* q = make_queue();
+        task_queue::task_t task1 = { 0, 0, 0, 1 };
+        q->enqueue_seq_to(task1, 1);
+        thread_loc loc = { 1, -1, 0, 1, 0 };
+        EXPECT(q->dequeue(task, loc) && task.pad == 1);
+        q->get_steal_stats(attempts, steals);
+        EXPECT(attempts == 0);
+        delete q;
+    }
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("task_queue: ok\n");
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,100 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Checks the sysfs topology reader against the fake tree in sysfs/: two
+   packages, each one core with two hardware threads, and two NUMA nodes
+   that take the even and the odd CPUs, and the locality groups built on 
+   it. Run it with MR_SYSFS_ROOT naming that tree, as "make check" does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "topology.h"
+#include "locality.h"
+
+static int failures = 0;
+
+#define EXPECT(cond)                                                    \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__,  \
+                #cond);                                                 \
+            ++failures;                                                 \
+        }                                                               \
+    } while (0)
+
+static bool same(std::vector<int> const& v, int a, int b, int c, int d)
+{
+    return v.size() == 4 && v[0] == a && v[1] == b && v[2] == c && v[3] == d;
+}
+
+int main(int argc, char *argv[])
+{
+    if (getenv("MR_SYSFS_ROOT") == NULL)
+    {
+        printf("USAGE: MR_SYSFS_ROOT=<fixture dir> %s\n", argv[0]);
+        exit(1);
+    }
+
+    std::vector<int> ids;
+    EXPECT(parse_cpu_list("0-2,5,7-8\n", ids));
+    EXPECT(ids.size() == 6 && ids[2] == 2 && ids[3] == 5 && ids[5] == 8);
+    EXPECT(!parse_cpu_list("3-1", ids));
+    EXPECT(!parse_cpu_list("x", ids));
+
+    cpu_topology const& topo = cpu_topology::get();
+    EXPECT(topo.valid());
+    EXPECT(topo.num_cpus() == 4);
+
+    EXPECT(topo.num_nodes() == 2);
+    EXPECT(topo.node_of(0) == 0);
+    EXPECT(topo.node_of(1) == 1);
+    EXPECT(topo.node_of(2) == 0);
+    EXPECT(topo.node_of(3) == 1);
+    EXPECT(topo.node_of(4) == -1);
+    EXPECT(topo.node_of(-1) == -1);
+
+    // one thread of each core first, the SMT siblings after them.
+    EXPECT(same(topo.core_order(), 0, 1, 2, 3));
+    EXPECT(same(topo.chip_order(), 0, 1, 2, 3));
+
+    // the locality groups are the nodes, with or without libnuma.
+    EXPECT(loc_get_num_lgrps() == 2);
+    int cpu = proc_get_cpuid();
+    EXPECT(loc_get_lgrp() == (cpu < 4 ? cpu % 2 : -1));
+
+    if (failures > 0)
+    {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("topology: ok\n");
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -0,0 +1,117 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Looks up words in an index written by inverted_index with MR_INDEX, see
+   index_file.h, and prints the lines they are on like inverted_index. 
+   -b times a lookup and decode of every word. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+
+#include "index_file.h"
+
+static double seconds(timespec const& begin, timespec const& end)
+{
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    bool bench = argc > 1 && strcmp(argv[1], "-b") == 0;
+    int first = bench ? 2 : 1;
+    if (argc <= first || (!bench && argc == first + 1))
+    {
+        printf("USAGE: %s <index> word...\n", argv[0]);
+        printf("       %s -b <index>\n", argv[0]);
+        exit(1);
+    }
+
+    timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    index_file f;
+    if (!f.open(argv[first]))
+    {
+        fprintf(stderr, "%s: not an index\n", argv[first]);
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "opened %s: %lu files, %lu words in %.1f us\n", 
+        argv[first], f.num_files(), f.num_terms(), seconds(begin, end) * 1e6);
+
+    std::vector<uint64_t> postings;
+    if (bench)
+    {
+        result_file const& terms = f.term_file();
+        uint64_t total = 0;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        for (uint64_t i = 0; i < terms.size(); i++)
+        {
+            uint64_t len;
+            char const* word = terms.key(i, len);
+            f.lookup(word, len, postings);
+            total += postings.size();
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double t = seconds(begin, end);
+        printf("%lu words, %lu postings, %.0f ns per lookup\n", 
+            terms.size(), total, terms.size() > 0 ? t * 1e9 / terms.size() : 0.0);
+        return 0;
+    }
+
+    // Words are stored upper case.
+    for (int a = first + 1; a < argc; a++)
+    {
+        std::string word(argv[a]);
+        for (size_t c = 0; c < word.size(); c++)
+            word[c] = toupper((unsigned char)word[c]);
+
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        f.lookup(word.data(), word.size(), postings);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        printf("%15s - ", word.c_str());
+        for (size_t j = 0; j < postings.size(); j++)
+        {
+            // With several files, say which one the line is in.
+            if (f.num_files() > 1)
+                printf("%s:", f.file_name(index_file_of(postings[j])));
+            printf("%lu ", index_line_of(postings[j]));
+        }
+        printf("\n");
+        fprintf(stderr, "%s: %lu lines in %.1f us\n", word.c_str(), 
+            postings.size(), seconds(begin, end) * 1e6);
+    }
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
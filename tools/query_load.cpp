@@ -0,0 +1,199 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Drives a query_server with a fixed number of clients, each sending the
+   queries of a file one after another and waiting for every reply, and
+   reports the queries per second and the latency percentiles. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "stddefines.h"
+
+#define DEFAULT_SOCKET "/tmp/phoenix_query.sock"
+#define DEFAULT_CLIENTS 8
+#define DEFAULT_QUERIES 10000
+
+static std::vector<std::string> queries;
+static sockaddr_un addr;
+
+struct client_t
+{
+    pthread_t           tid;
+    int                 id;
+    uint64_t            count;          // queries to send
+    uint64_t            errors;         // ERR replies
+    std::vector<double> latency;        // in seconds
+    bool                failed;
+};
+
+static double seconds(timespec const& begin, timespec const& end)
+{
+    return (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+}
+
+static void* client(void* arg)
+{
+    client_t& c = *(client_t*)arg;
+    c.failed = true;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    // Clients start at different queries.
+    std::string pending;
+    char buf[4096];
+    c.latency.reserve(c.count);
+    for (uint64_t i = 0; i < c.count; i++) {
+        std::string const& q = queries[(c.id + i) % queries.size()];
+        timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        if (write(fd, q.data(), q.size()) != (ssize_t)q.size())
+            break;
+
+        size_t nl;
+        while ((nl = pending.find('\n')) == std::string::npos) {
+            ssize_t n = read(fd, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                close(fd);
+                return NULL;
+            }
+            pending.append(buf, n);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        c.errors += pending.compare(0, 3, "ERR") == 0;
+        pending.erase(0, nl + 1);
+        c.latency.push_back(seconds(begin, end));
+    }
+
+    close(fd);
+    c.failed = c.latency.size() != c.count;
+    return NULL;
+}
+
+static double percentile(std::vector<double> const& sorted, double p)
+{
+    if (sorted.empty())
+        return 0;
+    size_t i = (size_t)(p / 100 * sorted.size());
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int main(int argc, char *argv[])
+{
+    char const* path = DEFAULT_SOCKET;
+    int clients = DEFAULT_CLIENTS;
+    uint64_t count = DEFAULT_QUERIES;
+    int c;
+    while ((c = getopt(argc, argv, "s:c:n:")) != -1) {
+        if (c == 's')
+            path = optarg;
+        else if (c == 'c')
+            clients = atoi(optarg);
+        else if (c == 'n')
+            count = strtoull(optarg, NULL, 10);
+        else
+            optind = argc;
+    }
+    if (optind != argc - 1 || clients <= 0)
+    {
+        printf("USAGE: %s [-s socket] [-c clients] [-n queries per client] <query file>\n", argv[0]);
+        exit(1);
+    }
+
+    // One query per line, empty lines skipped.
+    FILE* f = fopen(argv[optind], "r");
+    CHECK_ERROR(f == NULL);
+    char line[4096];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        size_t len = strcspn(line, "\n");
+        if (len > 0)
+            queries.push_back(std::string(line, len) + "\n");
+    }
+    fclose(f);
+    CHECK_ERROR(queries.empty());
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    CHECK_ERROR(strlen(path) >= sizeof(addr.sun_path));
+    strcpy(addr.sun_path, path);
+
+    std::vector<client_t> cs(clients);
+    timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (int i = 0; i < clients; i++) {
+        cs[i].id = i;
+        cs[i].count = count;
+        cs[i].errors = 0;
+        CHECK_ERROR(pthread_create(&cs[i].tid, NULL, client, &cs[i]) != 0);
+    }
+    std::vector<double> all;
+    uint64_t errors = 0;
+    bool failed = false;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(cs[i].tid, NULL);
+        all.insert(all.end(), cs[i].latency.begin(), cs[i].latency.end());
+        errors += cs[i].errors;
+        failed |= cs[i].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    std::sort(all.begin(), all.end());
+    double t = seconds(begin, end);
+    printf("%d clients, %lu queries in %.3f s: %.0f queries/s\n", clients, 
+        (uint64_t)all.size(), t, t > 0 ? all.size() / t : 0.0);
+    printf("latency us: p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+        percentile(all, 50) * 1e6, percentile(all, 90) * 1e6, 
+        percentile(all, 99) * 1e6, percentile(all, 99.9) * 1e6, 
+        all.empty() ? 0.0 : all.back() * 1e6);
+    if (errors > 0)
+        printf("%lu queries were not understood\n", errors);
+    if (failed)
+        printf("some clients lost the connection\n");
+
+    return failed ? 1 : 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
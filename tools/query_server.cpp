@@ -0,0 +1,362 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Answers queries on an index written by inverted_index with MR_INDEX, 
+   see index_file.h, over a unix socket. The index is mapped once and 
+   shared by a thread per client, nothing is recomputed per query. 
+
+   A client sends one query per line and gets one line back: the number 
+   of lines that match, then the first of them as inverted_index prints 
+   them, or "ERR" and why. A query longer than MAX_QUERY_LEN gets "ERR
+   query too long" and the connection is closed, and so is a client 
+   beyond the -c limit, after "ERR too many clients". A query is words, which must all be on a line,
+   "AND" between words does the same, "OR" between groups of them takes 
+   the lines of either, and a phrase in double quotes must occur as it 
+   is, e.g.
+
+       holmes AND watson OR "baker street"
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "atomic.h"
+#include "index_file.h"
+
+#define DEFAULT_SOCKET "/tmp/phoenix_query.sock"
+#define DEFAULT_DISP_NUM 50
+#define DEFAULT_MAX_CLIENTS 64
+#define MAX_QUERY_LEN (64 * 1024)
+
+static index_file idx;
+static uint64_t disp_num = DEFAULT_DISP_NUM;
+static unsigned int num_clients;            // client threads running
+
+typedef std::vector<uint64_t> lines_t;      // sorted index_postings
+
+// A query being answered, with room for its lists.
+class query
+{
+public:
+    explicit query(std::string const& text) : text(text), at(0) {}
+
+    // The lines of the query into OUT. Returns false with ERROR set if 
+    // it makes no sense.
+    bool run(lines_t& out) {
+        if (!parse_or(out))
+            return false;
+        skip_space();
+        if (at < text.size())
+            return fail("unexpected text");
+        return true;
+    }
+
+    std::string error;
+
+private:
+    std::string const& text;
+    size_t at;
+    std::vector<index_hit> hits, next_hits;
+
+    bool fail(char const* why) { error = why; return false; }
+
+    void skip_space() {
+        while (at < text.size() && isspace((unsigned char)text[at]))
+            at++;
+    }
+
+    // The next word, upper case, or an empty one.
+    std::string word() {
+        skip_space();
+        std::string w;
+        while (at < text.size() && !isspace((unsigned char)text[at]) && 
+            text[at] != '"')
+            w += toupper((unsigned char)text[at++]);
+        return w;
+    }
+
+    // Whether the operator OP is next, and if so skip it if SKIP.
+    bool next_is(char const* op, bool skip) {
+        skip_space();
+        size_t n = strlen(op);
+        if (text.compare(at, n, op) != 0 || (at + n < text.size() && 
+            !isspace((unsigned char)text[at + n]) && text[at + n] != '"'))
+            return false;
+        if (skip)
+            at += n;
+        return true;
+    }
+
+    bool parse_or(lines_t& out) {
+        if (!parse_and(out))
+            return false;
+        while (next_is("OR", true)) {
+            lines_t other, both;
+            if (!parse_and(other))
+                return false;
+            std::set_union(out.begin(), out.end(), other.begin(), 
+                other.end(), std::back_inserter(both));
+            out.swap(both);
+        }
+        return true;
+    }
+
+    bool parse_and(lines_t& out) {
+        if (!parse_atom(out))
+            return false;
+        for (;;) {
+            // OR is parse_or's to take.
+            skip_space();
+            if (at == text.size() || next_is("OR", false))
+                return true;
+            next_is("AND", true);
+            lines_t other, both;
+            if (!parse_atom(other))
+                return false;
+            std::set_intersection(out.begin(), out.end(), other.begin(), 
+                other.end(), std::back_inserter(both));
+            out.swap(both);
+        }
+    }
+
+    bool parse_atom(lines_t& out) {
+        skip_space();
+        if (at < text.size() && text[at] == '"') {
+            at++;
+            if (!phrase(out))
+                return false;
+            if (at == text.size() || text[at] != '"')
+                return fail("unterminated phrase");
+            at++;
+            return true;
+        }
+        std::string w = word();
+        if (w.empty())
+            return fail("missing word");
+        idx.lookup(w.data(), w.size(), out);
+        return true;
+    }
+
+    // The lines on which the words up to the closing quote start. Hits 
+    // of the first word are kept while the following words come right 
+    // after them.
+    bool phrase(lines_t& out) {
+        std::string w = word();
+        if (w.empty())
+            return fail("empty phrase");
+        idx.hits(w.data(), w.size(), hits);
+        for (uint64_t n = 1; !(w = word()).empty(); n++) {
+            idx.hits(w.data(), w.size(), next_hits);
+            size_t kept = 0, j = 0;
+            for (size_t i = 0; i < hits.size(); i++) {
+                while (j < next_hits.size() && next_hits[j].pos < 
+                    hits[i].pos + n)
+                    j++;
+                if (j < next_hits.size() && next_hits[j].pos == 
+                    hits[i].pos + n)
+                    hits[kept++] = hits[i];
+            }
+            hits.resize(kept);
+        }
+
+        out.clear();
+        for (size_t i = 0; i < hits.size(); i++)
+            out.push_back(index_posting(index_file_of(hits[i].pos), 
+                hits[i].line));
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+        return true;
+    }
+};
+
+// The reply to the query TEXT, ending with a newline.
+static void answer(std::string const& text, std::string& reply)
+{
+    lines_t lines;
+    query q(text);
+    if (!q.run(lines)) {
+        reply = "ERR " + q.error + "\n";
+        return;
+    }
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%lu", (uint64_t)lines.size());
+    reply = buf;
+    for (size_t j = 0; j < lines.size() && j < disp_num; j++) {
+        reply += ' ';
+        // With several files, say which one the line is in.
+        if (idx.num_files() > 1) {
+            reply += idx.file_name(index_file_of(lines[j]));
+            reply += ':';
+        }
+        snprintf(buf, sizeof(buf), "%lu", index_line_of(lines[j]));
+        reply += buf;
+    }
+    reply += '\n';
+}
+
+static bool write_all(int fd, char const* data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Serves one client until it hangs up.
+static void* client(void* arg)
+{
+    int fd = (int)(intptr_t)arg;
+    std::string pending, reply;
+    char buf[4096];
+
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        pending.append(buf, n);
+
+        // Answer every complete line, in order.
+        size_t begin = 0, end;
+        bool ok = true;
+        while (ok && (end = pending.find('\n', begin)) != std::string::npos) {
+            if (end - begin > MAX_QUERY_LEN)
+                break;
+            answer(pending.substr(begin, end - begin), reply);
+            ok = write_all(fd, reply.data(), reply.size());
+            begin = end + 1;
+        }
+        if (!ok)
+            break;
+        pending.erase(0, begin);
+        // Do not buffer a line without end.
+        if (pending.size() > MAX_QUERY_LEN) {
+            static char const too_long[] = "ERR query too long\n";
+            write_all(fd, too_long, sizeof(too_long) - 1);
+            break;
+        }
+    }
+
+    close(fd);
+    fetch_and_dec(&num_clients);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    char const* path = DEFAULT_SOCKET;
+    unsigned int max_clients = DEFAULT_MAX_CLIENTS;
+    int c;
+    while ((c = getopt(argc, argv, "s:n:c:")) != -1) {
+        if (c == 's')
+            path = optarg;
+        else if (c == 'n')
+            disp_num = strtoull(optarg, NULL, 10);
+        else if (c == 'c')
+            max_clients = strtoul(optarg, NULL, 10);
+        else
+            optind = argc;
+    }
+    if (optind != argc - 1)
+    {
+        printf("USAGE: %s [-s socket] [-n lines per reply] "
+            "[-c max clients] <index>\n", argv[0]);
+        exit(1);
+    }
+
+    if (!idx.open(argv[optind]))
+    {
+        fprintf(stderr, "%s: not an index\n", argv[optind]);
+        exit(1);
+    }
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    CHECK_ERROR(strlen(path) >= sizeof(addr.sun_path));
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int sock;
+    CHECK_ERROR((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0);
+    CHECK_ERROR(bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0);
+    CHECK_ERROR(listen(sock, SOMAXCONN) < 0);
+    // Clients that hang up early are no reason to stop.
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("query_server: %lu files, %lu words, on %s\n", idx.num_files(), 
+        idx.num_terms(), path);
+    fflush(stdout);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (;;) {
+        int fd = accept(sock, NULL, NULL);
+        if (fd < 0) {
+            CHECK_ERROR(errno != EINTR && errno != ECONNABORTED && 
+                errno != EMFILE && errno != ENFILE);
+            continue;
+        }
+        // A thread each is fine for some clients, not for any number.
+        if (fetch_and_inc(&num_clients) >= max_clients) {
+            static char const too_many[] = "ERR too many clients\n";
+            write_all(fd, too_many, sizeof(too_many) - 1);
+            close(fd);
+            fetch_and_dec(&num_clients);
+            continue;
+        }
+        pthread_t tid;
+        if (pthread_create(&tid, &attr, client, (void*)(intptr_t)fd) != 0) {
+            close(fd);
+            fetch_and_dec(&num_clients);
+        }
+    }
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
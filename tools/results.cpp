@@ -0,0 +1,114 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Looks up keys in a result file written with MR_RESULTS, see 
+   result_file.h, or lists all of it. -b times a lookup of every key. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <string>
+
+#include "result_file.h"
+
+static void print_entry(result_file const& f, uint64_t i)
+{
+    uint64_t len;
+    char const* key = f.key(i, len);
+    printf("%15.*s - ", (int)len, key);
+
+    // Counts are the common case, else show the bytes.
+    unsigned char const* v = (unsigned char const*)f.value(i);
+    if (f.value_size() == sizeof(uint64_t))
+        printf("%lu", *(uint64_t const*)v);
+    else
+        for (uint64_t b = 0; b < f.value_size(); b++)
+            printf("%02x", v[b]);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    bool bench = argc > 1 && strcmp(argv[1], "-b") == 0;
+    int first = bench ? 2 : 1;
+    if (argc <= first)
+    {
+        printf("USAGE: %s [-b] <result file> [key]...\n", argv[0]);
+        exit(1);
+    }
+
+    result_file f;
+    if (!f.open(argv[first]))
+    {
+        fprintf(stderr, "%s: not a result file\n", argv[first]);
+        exit(1);
+    }
+
+    if (bench)
+    {
+        timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        uint64_t found = 0;
+        for (uint64_t i = 0; i < f.size(); i++)
+        {
+            uint64_t len;
+            char const* key = f.key(i, len);
+            found += f.find(key, len) == i;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double t = (end.tv_sec - begin.tv_sec) + 
+            (end.tv_nsec - begin.tv_nsec) / 1e9;
+        printf("%lu of %lu keys found, %.0f ns per lookup\n", found, 
+            f.size(), f.size() > 0 ? t * 1e9 / f.size() : 0.0);
+    }
+    else if (argc == first + 1)
+    {
+        for (uint64_t i = 0; i < f.size(); i++)
+            print_entry(f, i);
+    }
+    else
+    {
+        // Keys are stored upper case by the apps.
+        for (int a = first + 1; a < argc; a++)
+        {
+            std::string key(argv[a]);
+            for (size_t c = 0; c < key.size(); c++)
+                key[c] = toupper((unsigned char)key[c]);
+            uint64_t i = f.find(key.data(), key.size());
+            if (i < f.size())
+                print_entry(f, i);
+            else
+                printf("%15s - not found\n", key.c_str());
+        }
+    }
+
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
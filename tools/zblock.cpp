@@ -0,0 +1,88 @@
+/* Copyright (c) 2007-2011, Stanford University
+* All rights reserved.
+*
+* Redistribution and use in source and binary forms, with or without
+* modification, are permitted provided that the following conditions are met:
+*     * Redistributions of source code must retain the above copyright
+*       notice, this list of conditions and the following disclaimer.
+*     * Redistributions in binary form must reproduce the above copyright
+*       notice, this list of conditions and the following disclaimer in the
+*       documentation and/or other materials provided with the distribution.
+*     * Neither the name of Stanford University nor the names of its 
+*       contributors may be used to endorse or promote products derived from 
+*       this software without specific prior written permission.
+*
+* THIS SOFTWARE IS PROVIDED BY STANFORD UNIVERSITY ``AS IS'' AND ANY
+* EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+* WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+* DISCLAIMED. IN NO EVENT SHALL STANFORD UNIVERSITY BE LIABLE FOR ANY
+* DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+* (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+* LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+* ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+* SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/ 
+
+
+/* Converts text to the block-compressed format the apps read in 
+   parallel, see zblock.h. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "zblock.h"
+#include "stddefines.h"
+
+#define DEFAULT_BLOCK_KB 1024
+#define DEFAULT_LEVEL 6
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        printf("USAGE: %s <text file> <output file> [block size in KB] "
+            "[level 1-9]\n", argv[0]);
+        exit(1);
+    }
+
+    uint64_t block_kb = argc > 3 ? atoi(argv[3]) : DEFAULT_BLOCK_KB;
+    int level = argc > 4 ? atoi(argv[4]) : DEFAULT_LEVEL;
+    CHECK_ERROR(block_kb == 0);
+
+    int fd;
+    struct stat finfo;
+    char const* data = NULL;
+    CHECK_ERROR((fd = open(argv[1], O_RDONLY)) < 0);
+    CHECK_ERROR(fstat(fd, &finfo) < 0);
+    if (finfo.st_size > 0)
+    {
+        CHECK_ERROR((data = (char const*)mmap(0, finfo.st_size, PROT_READ, 
+            MAP_PRIVATE, fd, 0)) == MAP_FAILED);
+        madvise((void*)data, finfo.st_size, MADV_SEQUENTIAL);
+    }
+
+    int out;
+    CHECK_ERROR((out = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0);
+    CHECK_ERROR(!zblock_write(out, data, finfo.st_size, block_kb * 1024, 
+        level));
+    CHECK_ERROR(close(out) < 0);
+
+    struct stat oinfo;
+    CHECK_ERROR(stat(argv[2], &oinfo) < 0);
+    printf("%s: %lu bytes in, %lu bytes out\n", argv[2], 
+        (uint64_t)finfo.st_size, (uint64_t)oinfo.st_size);
+
+    if (data != NULL) {
+        CHECK_ERROR(munmap((void*)data, finfo.st_size) < 0);
+    }
+    CHECK_ERROR(close(fd) < 0);
+    return 0;
+}
+
+// vim: ts=8 sw=4 sts=4 smarttab smartindent
@@ -30,135 +30,91 @@
 #include <string.h>
 #include <ctype.h>
 #include <fstream>
+#include <string>
 
 #ifdef TBB
 #include "tbb/scalable_allocator.h"
 #endif
 
 #include "map_reduce.h"
+#include "str_key.h"
+#include "file_set.h"
+#include "prefetch_reader.h"
+#include "stream_reader.h"
+#include "tokenizer.h"
 #define DEFAULT_DISP_NUM 20
+#define DEFAULT_FRONT_CACHE 512
+#define CHUNK_SIZE (1024*1024)
+#define DEFAULT_READERS 2
 
-// a passage from the text. The input data to the Map-Reduce
-struct wc_string {
-    char* data;
-    uint64_t len;
-};
-
-// a single null-terminated word
-struct wc_word {
-    char* data;
-    
-    // necessary functions to use this as a key
-    bool operator<(wc_word const& other) const {
-        return strcmp(data, other.data) < 0;
-    }
-    bool operator==(wc_word const& other) const {
-        return strcmp(data, other.data) == 0;
-    }
-};
-
-
-// a hash for the word
-struct wc_word_hash
-{
-    // FNV-1a hash for 64 bits
-    size_t operator()(wc_word const& key) const
-    {
-        char* h = key.data;
-        uint64_t v = 14695981039346656037ULL;
-        while (*h != 0)
-            v = (v ^ (size_t)(*(h++))) * 1099511628211ULL;
-        return v;
-    }
-};
+// a single word, pointing into the input. Words are neither terminated
+// nor upper-cased in place, they compare and hash as if upper case.
+typedef str_key<str_key_nocase_traits> wc_word;
+typedef std::tr1::hash<wc_word> wc_word_hash;
 
 #ifdef MUST_USE_FIXED_HASH
-class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, fixed_hash_container<wc_word, uint64_t, sum_combiner, 32768, wc_word_hash
+class WordsMR : public MapReduceSort<WordsMR, file_set::chunk, wc_word, uint64_t, fixed_hash_container<wc_word, uint64_t, sum_combiner, 32768, wc_word_hash
 #else
-class WordsMR : public MapReduceSort<WordsMR, wc_string, wc_word, uint64_t, hash_container<wc_word, uint64_t, sum_combiner, wc_word_hash 
+class WordsMR : public MapReduceSort<WordsMR, file_set::chunk, wc_word, uint64_t, hash_container<wc_word, uint64_t, sum_combiner, wc_word_hash 
 #endif
 #ifdef TBB
     , tbb::scalable_allocator
+#else
+    , huge_page_allocator
 #endif
 > >
 {
-    char* data;
-    uint64_t data_size;
-    uint64_t chunk_size;
-    uint64_t splitter_pos;
+    file_set& files;
     std::vector<wc_word> stopwords;
+    // copies of the words of streams, whose pieces go away once mapped
+    mutable str_key_pool<str_key_nocase_traits> copies;
 public:
-    explicit WordsMR(char* _data, uint64_t length, uint64_t _chunk_size) :
-        data(_data), data_size(length), chunk_size(_chunk_size), 
-            splitter_pos(0) {}
+    // The input is a set of files, or a single file already in memory.
+    // Each map task gets a run of small files or a piece of a large one.
+    explicit WordsMR(file_set& _files) : files(_files) {}
 
-    void* locate(data_type* str, uint64_t len) const
+    void* locate(data_type* c, uint64_t len) const
     {
-        return str->data;
+        return (void*)files.address(*c);
     }
 
-    void map(data_type const& s, map_container& out) const
+    // Emits the words that are not stop words.
+    struct word_emitter
     {
-        for (uint64_t i = 0; i < s.len; i++)
-        {
-            s.data[i] = toupper(s.data[i]);
+        WordsMR const* mr;
+        map_container& out;
+        bool copy;
+
+        void operator()(char const* data, uint64_t len, uint64_t) const {
+            wc_word word(data, len);
+            for(size_t k = 0; k < mr->stopwords.size(); k++){
+                if(mr->stopwords[k] == word)
+                    return;
+            }
+            if(copy)
+                word = mr->copies.intern(word);
+            mr->emit_intermediate(out, word, 1);
         }
+    };
 
-
-        uint64_t i = 0;
-        while(i < s.len)
-        {            
-            while(i < s.len && (s.data[i] < 'A' || s.data[i] > 'Z'))
-                i++;
-            uint64_t start = i;
-            while(i < s.len && ((s.data[i] >= 'A' && s.data[i] <= 'Z') || s.data[i] == '\''))
-                i++;
-            if(i > start)
-            {
-                s.data[i] = 0;
-                wc_word word = { s.data+start };
-                bool present = false;
-
-                for(int k = 0; k < stopwords.size(); k++){
-                    if(stopwords.at(k) == word){
-                        present = true;
-                        break;
-                    }
-                }
-
-                if(!present)emit_intermediate(out, word, 1);
-            }
+    void map(data_type const& c, map_container& out) const
+    {
+        for (uint64_t p = c.first; p < c.first + c.count; p++)
+        {
+            file_set::piece s = files.get(p);
+            word_emitter emit = { this, out, files.streamed(s.file) };
+            tokenize<false>(s.data, s.len, s.len, emit);
+            files.release(p);
         }
     }
 
     /** wordcount split()
-     *  Memory map the file and divide file on a word border i.e. a space.
+     *  Pack small files together and divide large ones on a word border
+     *  i.e. a space, see file_set::split.
      */
-    int split(wc_string& out)
+    int split(file_set::chunk& out)
     {
-        /* End of data reached, return FALSE. */
-        if ((uint64_t)splitter_pos >= data_size)
-        {
-            return 0;
-        }
-
-        /* Determine the nominal end point. */
-        uint64_t end = std::min(splitter_pos + chunk_size, data_size);
-
-        /* Move end point to next word break */
-        while(end < data_size && 
-            data[end] != ' ' && data[end] != '\t' &&
-            data[end] != '\r' && data[end] != '\n')
-            end++;
-
-        /* Set the start of the next data. */
-        out.data = data + splitter_pos;
-        out.len = end - splitter_pos;
-        
-        splitter_pos = end;
-
-        /* Return true since the out data is valid. */
-        return 1;
+        return files.split(out);
     }
 
     void set_stopwords(char stop_words_[]){
@@ -169,26 +125,31 @@ public:
 
         for(uint64_t i = 0; i < len ; i++)stop_words[i] = toupper(stop_words[i]);
 
-        wc_word temp;
-        temp.data = stop_words;
-        stopwords.push_back(temp);
+        stopwords.push_back(wc_word(stop_words, len));
     }
 
     bool sort(keyval const& a, keyval const& b) const
     {
-        return a.val < b.val || (a.val == b.val && strcmp(a.key.data, b.key.data) > 0);
+        return a.val < b.val || (a.val == b.val && a.key.compare(b.key) > 0);
     }
 };
 
-#define NO_MMAP
+// Whether ARG is the number of results to display rather than an input.
+static bool is_disp_num(char const* arg)
+{
+    struct stat st;
+    return arg[strspn(arg, "0123456789")] == '\0' && stat(arg, &st) < 0;
+}
 
 int main(int argc, char *argv[]) 
 {
-    int fd;
-    char * fdata;
+    int fd = -1;
+    char * fdata = NULL;
+    prefetch_reader * reader = NULL;
+    stream_reader * stream = NULL;
     unsigned int disp_num;
     struct stat finfo;
-    char * fname, * disp_num_str;
+    char * fname, * disp_num_str = NULL;
     struct timespec begin, end;
     //std::vector<wc_word> stopwords;
     FILE* stopwords_f;
@@ -199,38 +160,82 @@ int main(int argc, char *argv[])
     // Make sure a filename is specified
     if (argv[1] == NULL)
     {
-        printf("USAGE: %s <filename> [Top # of results to display]\n", argv[0]);
+        printf("USAGE: %s <file, directory or ->... [Top # of results to display]\n", argv[0]);
         exit(1);
     }
 
+    int inputs = argc - 1;
+    if (inputs > 1 && is_disp_num(argv[argc-1]))
+        disp_num_str = argv[inputs--];
     fname = argv[1];
-    disp_num_str = argv[2];
 
     printf("Wordcount: Running...\n");
 
-    // Read in the file
-    CHECK_ERROR((fd = open(fname, O_RDONLY)) < 0);
-    // Get the file info (for file length)
-    CHECK_ERROR(fstat(fd, &finfo) < 0);
-#ifndef NO_MMAP
-#ifdef MMAP_POPULATE
-    // Memory map the file
-    CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0)) == NULL);
-#else
-    // Memory map the file
-    CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size + 1, 
-        PROT_READ, MAP_PRIVATE, fd, 0)) == NULL);
-#endif
-#else
-    uint64_t r = 0;
-
-    fdata = (char *)malloc (finfo.st_size);
-    CHECK_ERROR (fdata == NULL);
-    while(r < (uint64_t)finfo.st_size)
-        r += pread (fd, fdata + r, finfo.st_size, r);
-    CHECK_ERROR (r != (uint64_t)finfo.st_size);
-#endif    
+    file_set files(CHUNK_SIZE);
+    bool mapped = atoi(GETENV("MR_MMAP")) != 0;
+    if (inputs > 1 || strcmp(fname, "-") == 0 || 
+        stat(fname, &finfo) < 0 || !S_ISREG(finfo.st_mode) ||
+        file_set::compressed(fname))
+    {
+        // A corpus of files, mapped as the map tasks get to them, and "-"
+        // for standard input, split as it is read. Compressed files are 
+        // decompressed by the map tasks.
+        for (int i = 1; i <= inputs; i++)
+        {
+            if (strcmp(argv[i], "-") == 0 && stream == NULL)
+            {
+                stream = new stream_reader(0, CHUNK_SIZE);
+                files.add("stdin", *stream);
+            }
+            else
+                CHECK_ERROR(!files.add(argv[i]));
+        }
+    }
+    else
+    {
+        // Read in the file
+        CHECK_ERROR((fd = open(fname, O_RDONLY)) < 0);
+        // Get the file info (for file length)
+        CHECK_ERROR(fstat(fd, &finfo) < 0);
+        // With MR_MMAP=1 the file is mapped read-only instead of copied. 
+        // The map tasks read it ahead as they go.
+        if (mapped)
+        {
+            CHECK_ERROR((fdata = (char*)mmap(0, finfo.st_size, 
+                PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED);
+            madvise(fdata, finfo.st_size, MADV_SEQUENTIAL);
+            madvise(fdata, std::min((uint64_t)finfo.st_size, 
+                (uint64_t)CHUNK_SIZE), MADV_WILLNEED);
+            files.add(fname, fdata, finfo.st_size, true);
+        }
+        else
+        {
+            fdata = (char *)huge_alloc (finfo.st_size);
+            CHECK_ERROR (fdata == NULL);
+            // Place the input on all nodes before reading it in.
+            loc_spread_mem (fdata, finfo.st_size);
+
+            // The copy is read in on MR_READERS threads while the map 
+            // tasks work on what is there. MR_PREFETCH=0 reads all of it
+            // up front.
+            char const* prefetch_str = getenv("MR_PREFETCH");
+            if (prefetch_str == NULL || atoi(prefetch_str) != 0)
+            {
+                char const* readers_str = getenv("MR_READERS");
+                reader = new prefetch_reader(fd, fdata, finfo.st_size, 
+                    readers_str ? atoi(readers_str) : DEFAULT_READERS);
+                files.add(fname, *reader);
+            }
+            else
+            {
+                uint64_t r = 0;
+                while(r < (uint64_t)finfo.st_size)
+                    r += pread (fd, fdata + r, finfo.st_size, r);
+                CHECK_ERROR (r != (uint64_t)finfo.st_size);
+                files.add(fname, fdata, finfo.st_size);
+            }
+        }
+    }
     //read stop words
     if (!stopwords_f) {
         printf("Unable to open file stopwords.txt\n");
@@ -250,7 +255,17 @@ int main(int argc, char *argv[])
     printf("Wordcount: Calling MapReduce Scheduler Wordcount\n");
     get_time (begin);
     std::vector<WordsMR::keyval> result;    
-    WordsMR mapReduce(fdata, finfo.st_size, 1024*1024);
+    WordsMR mapReduce(files);
+    // Map a stream as it is split. So too a file still being read in, 
+    // unless there are locality groups to queue its chunks by, which 
+    // takes splitting it all first.
+    if (stream != NULL || (reader != NULL && loc_get_num_lgrps() <= 1))
+        mapReduce.setStreaming(true);
+#ifndef MUST_USE_FIXED_HASH
+    // A small front cache catches the handful of very frequent words.
+    char const* cache_str = getenv("MR_FRONTCACHE");
+    mapReduce.setFrontCache(cache_str ? atoi(cache_str) : DEFAULT_FRONT_CACHE);
+#endif
 
     //Initialize stop words
     char stop_word[20];
@@ -275,9 +290,28 @@ int main(int argc, char *argv[])
 
 #ifdef TIMING
     print_time("library", begin, end);
+#ifndef MUST_USE_FIXED_HASH
+    uint64_t hits, misses;
+    mapReduce.getFrontCacheStats(hits, misses);
+    if(hits + misses > 0)
+        printf("front cache hit rate : %.3f\n", 
+            hits / (double)(hits + misses));
+#endif
 #endif
     printf("Wordcount: MapReduce Completed\n");
 
+    // MR_RESULTS=file also writes all results in binary, see result_file.h.
+    char const* results_path = getenv("MR_RESULTS");
+    if (results_path != NULL)
+    {
+        get_time (begin);
+        CHECK_ERROR(mapReduce.write_results(results_path, result) < 0);
+        get_time (end);
+#ifdef TIMING
+        print_time("write results", begin, end);
+#endif
+    }
+
     get_time (begin);
 
     unsigned int dn = std::min(disp_num, (unsigned int)result.size());
@@ -285,7 +319,7 @@ int main(int argc, char *argv[])
     uint64_t total = 0;
     for (size_t i = 0; i < dn; i++)
     {
-        printf("%15s - %lu\n", result[result.size()-1-i].key.data, result[result.size()-1-i].val);
+        printf("%15s - %lu\n", result[result.size()-1-i].key.str().c_str(), result[result.size()-1-i].val);
     }
 
     for(size_t i = 0; i < result.size(); i++)
@@ -295,12 +329,17 @@ int main(int argc, char *argv[])
 
     printf("Total: %lu\n", total);
 
-#ifndef NO_MMAP
-    CHECK_ERROR(munmap(fdata, finfo.st_size + 1) < 0);
-#else
-    free (fdata);
-#endif
-    CHECK_ERROR(close(fd) < 0);
+    // A corpus is unmapped by the file set.
+    delete stream;
+    if (fd >= 0) {
+        if (mapped) {
+            CHECK_ERROR(munmap(fdata, finfo.st_size) < 0);
+        } else {
+            delete reader;
+            huge_free (fdata, finfo.st_size);
+        }
+        CHECK_ERROR(close(fd) < 0);
+    }
 
     get_time (end);
 